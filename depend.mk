@@ -29,7 +29,7 @@ $(LIBCOMMON_ROOT)src/exec.o: $(LIBCOMMON_ROOT)src/exec.c $(LIBCOMMON_ROOT)includ
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/getopt.o: $(LIBCOMMON_ROOT)src/getopt.c $(LIBCOMMON_ROOT)include/common/getopt.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/lazy.o: $(LIBCOMMON_ROOT)src/lazy.c $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/lazy.h $(LIBCOMMON_ROOT)include/common/spin.h
+$(LIBCOMMON_ROOT)src/lazy.o: $(LIBCOMMON_ROOT)src/lazy.c $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/lazy.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/waiter.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/logcallback.o: $(LIBCOMMON_ROOT)src/logcallback.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/thread.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
@@ -37,7 +37,7 @@ $(LIBCOMMON_ROOT)src/logger.o: $(LIBCOMMON_ROOT)src/logger.c $(LIBCOMMON_ROOT)in
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/monotonic.o: $(LIBCOMMON_ROOT)src/monotonic.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/lazy.h $(LIBCOMMON_ROOT)include/common/time.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/mutex.o: $(LIBCOMMON_ROOT)src/mutex.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h
+$(LIBCOMMON_ROOT)src/mutex.o: $(LIBCOMMON_ROOT)src/mutex.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/thread.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/path.o: $(LIBCOMMON_ROOT)src/path.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/size.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
@@ -73,32 +73,46 @@ $(LIBCOMMON_ROOT)src/utf8dec.o: $(LIBCOMMON_ROOT)src/utf8dec.c $(LIBCOMMON_ROOT)
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/utf8enc.o: $(LIBCOMMON_ROOT)src/utf8enc.c $(LIBCOMMON_ROOT)include/common/utf.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/waiter.o: $(LIBCOMMON_ROOT)src/waiter.c $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/waiter.h
+$(LIBCOMMON_ROOT)src/waiter.o: $(LIBCOMMON_ROOT)src/waiter.c $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/time.h $(LIBCOMMON_ROOT)include/common/waiter.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/winuname.o: $(LIBCOMMON_ROOT)src/winuname.c $(LIBCOMMON_ROOT)include/common/uname.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/winutf.o: $(LIBCOMMON_ROOT)src/winutf.c $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h
 	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/rwlock-biased.o: $(LIBCOMMON_ROOT)src/rwlock-biased.c $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/time.h
+	$(CC) $(CFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/dtorqueue.o: $(LIBCOMMON_ROOT)src/dtorqueue.cc $(LIBCOMMON_ROOT)include/common/c++/dtorqueue.h $(LIBCOMMON_ROOT)include/common/error.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/linereader.o: $(LIBCOMMON_ROOT)src/linereader.cc $(LIBCOMMON_ROOT)include/common/c++/linereader.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h
+$(LIBCOMMON_ROOT)src/linereader.o: $(LIBCOMMON_ROOT)src/linereader.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/linereader.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/memorystream.o: $(LIBCOMMON_ROOT)src/memorystream.cc $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-self.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
+$(LIBCOMMON_ROOT)src/memorystream.o: $(LIBCOMMON_ROOT)src/memorystream.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock-self.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/pstream.o: $(LIBCOMMON_ROOT)src/pstream.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/size.h
+$(LIBCOMMON_ROOT)src/pstream.o: $(LIBCOMMON_ROOT)src/pstream.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/size.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)src/asyncio.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/refcnt-cpp.o: $(LIBCOMMON_ROOT)src/refcnt-cpp.cc $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-self.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
+$(LIBCOMMON_ROOT)src/refcnt-cpp.o: $(LIBCOMMON_ROOT)src/refcnt-cpp.cc $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock-self.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/scheduler.o: $(LIBCOMMON_ROOT)src/scheduler.cc $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/sem.h
+$(LIBCOMMON_ROOT)src/scheduler.o: $(LIBCOMMON_ROOT)src/scheduler.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/sem.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/stream.o: $(LIBCOMMON_ROOT)src/stream.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h
+$(LIBCOMMON_ROOT)src/stream.o: $(LIBCOMMON_ROOT)src/stream.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/thread-cpp.o: $(LIBCOMMON_ROOT)src/thread-cpp.cc $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/thread.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBCOMMON_ROOT)src/worker.o: $(LIBCOMMON_ROOT)src/worker.cc $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/ring.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/worker.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/rwlock-self.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/sem.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
+$(LIBCOMMON_ROOT)src/threadpool.o: $(LIBCOMMON_ROOT)src/threadpool.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/threadpool.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/sem.h $(LIBCOMMON_ROOT)include/common/thread.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/worker.o: $(LIBCOMMON_ROOT)src/worker.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/ring.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/timerwheel.h $(LIBCOMMON_ROOT)include/common/c++/worker.h $(LIBCOMMON_ROOT)include/common/cas.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/sem.h $(LIBCOMMON_ROOT)include/common/spin.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/time.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/bundle-apple.o: $(LIBCOMMON_ROOT)src/bundle-apple.m
 	$(CC) $(OBJCFLAGS) $(CFLAGS) $(LIBCOMMON_OBJCFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_OBJCFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/timerwheel.o: $(LIBCOMMON_ROOT)src/timerwheel.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/timerwheel.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/coroutine.o: $(LIBCOMMON_ROOT)src/coroutine.cc $(LIBCOMMON_ROOT)include/common/c++/coroutine.h $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/bufferedstream.o: $(LIBCOMMON_ROOT)src/bufferedstream.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/asyncio.o: $(LIBCOMMON_ROOT)src/asyncio.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/scheduler.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/c++/threadpool.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/lazy.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/sem.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)src/asyncio.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBCOMMON_ROOT)src/blockcache.o: $(LIBCOMMON_ROOT)src/blockcache.cc $(LIBCOMMON_ROOT)include/common/c++/function.h $(LIBCOMMON_ROOT)include/common/c++/lock.h $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/c++/stream.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/lazy.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/mutex.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBCOMMON_ROOT)include/common/rwlock-biased.h $(LIBCOMMON_ROOT)include/common/rwlock.h $(LIBCOMMON_ROOT)include/common/thread.h $(LIBCOMMON_ROOT)include/common/waiter.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBCOMMON_CXXFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/error-apple.o: $(LIBCOMMON_ROOT)src/error-apple.m $(LIBCOMMON_ROOT)include/common/error.h
 	$(CC) $(OBJCFLAGS) $(CFLAGS) $(LIBCOMMON_OBJCFLAGS) $(LIBCOMMON_CFLAGS) $(LATE_OBJCFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBCOMMON_ROOT)src/crypto/hash.o: $(LIBCOMMON_ROOT)src/crypto/hash.c $(LIBCOMMON_ROOT)include/common/crypto/hash.h $(LIBCOMMON_ROOT)include/common/crypto/misc.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h
@@ -0,0 +1,402 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_cxx_coroutine_h_
+#define common_cxx_coroutine_h_
+
+//
+// C++20 coroutine support.  Everything here is compiled out unless the
+// compiler provides coroutines; check COMMON_HAVE_COROUTINES.
+//
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define COMMON_HAVE_COROUTINES 1
+#endif
+#endif
+
+#if defined(COMMON_HAVE_COROUTINES)
+
+#include "scheduler.h"
+#include "stream.h"
+#include "function.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <string.h>
+
+namespace common {
+
+template<typename T = void>
+class Task;
+
+namespace internal {
+
+// Coroutine frames are recycled through per-thread free lists, so that
+// a short-lived Task does not cost a trip to the general-purpose heap.
+//
+void *
+AllocateCoroutineFrame(size_t size);
+
+void
+FreeCoroutineFrame(void *p, size_t size);
+
+inline void
+MoveError(error *dst, error *src)
+{
+   error_clear(dst);
+   memcpy((void*)dst, (void*)src, sizeof(*dst));
+   memset((void*)src, 0, sizeof(*src));
+}
+
+struct TaskPromiseBase
+{
+   std::coroutine_handle<> continuation;
+   std::exception_ptr exception;
+   bool detached = false;
+
+   static void *
+   operator new(size_t size)
+   {
+      return AllocateCoroutineFrame(size);
+   }
+
+   static void
+   operator delete(void *p, size_t size)
+   {
+      FreeCoroutineFrame(p, size);
+   }
+
+   struct FinalAwaiter
+   {
+      bool await_ready() noexcept { return false; }
+
+      template<typename Promise>
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<Promise> h) noexcept
+      {
+         auto &p = h.promise();
+         if (p.continuation)
+            return p.continuation;
+         if (p.detached)
+            h.destroy();
+         return std::noop_coroutine();
+      }
+
+      void await_resume() noexcept {}
+   };
+
+   // Tasks do not run until they are awaited or started.
+   //
+   std::suspend_always initial_suspend() noexcept { return {}; }
+   FinalAwaiter final_suspend() noexcept { return {}; }
+
+   void
+   unhandled_exception()
+   {
+      if (detached)
+         std::terminate();
+      exception = std::current_exception();
+   }
+};
+
+template<typename T>
+struct TaskPromise : public TaskPromiseBase
+{
+   std::optional<T> value;
+
+   Task<T> get_return_object();
+
+   template<typename U>
+   void
+   return_value(U &&v)
+   {
+      value.emplace(std::forward<U>(v));
+   }
+
+   T
+   Result()
+   {
+      if (exception)
+         std::rethrow_exception(exception);
+      return std::move(*value);
+   }
+};
+
+template<>
+struct TaskPromise<void> : public TaskPromiseBase
+{
+   Task<void> get_return_object();
+
+   void return_void() {}
+
+   void
+   Result()
+   {
+      if (exception)
+         std::rethrow_exception(exception);
+   }
+};
+
+} // end namespace
+
+//
+// A coroutine returning T.  It starts running when it is co_awaited, or
+// when Start() is called, and is move-only.  Awaiting an empty Task, one
+// default-constructed or moved from, throws std::logic_error.
+//
+template<typename T>
+class Task
+{
+public:
+   typedef internal::TaskPromise<T> promise_type;
+
+private:
+   std::coroutine_handle<promise_type> handle;
+
+   friend struct internal::TaskPromise<T>;
+
+   explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+public:
+   Task() : handle(nullptr) {}
+   Task(const Task &) = delete;
+   Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+   ~Task()
+   {
+      if (handle)
+         handle.destroy();
+   }
+
+   Task &
+   operator=(Task &&other) noexcept
+   {
+      if (&other != this)
+      {
+         if (handle)
+            handle.destroy();
+         handle = std::exchange(other.handle, nullptr);
+      }
+      return *this;
+   }
+
+   // Runs the task with nobody waiting on it.  The frame frees itself
+   // when the coroutine finishes.
+   //
+   void
+   Start(void)
+   {
+      auto h = std::exchange(handle, nullptr);
+      if (h)
+      {
+         h.promise().detached = true;
+         h.resume();
+      }
+   }
+
+   auto
+   operator co_await() noexcept
+   {
+      struct Awaiter
+      {
+         std::coroutine_handle<promise_type> handle;
+
+         bool
+         await_ready() noexcept
+         {
+            return !handle || handle.done();
+         }
+
+         std::coroutine_handle<>
+         await_suspend(std::coroutine_handle<> caller) noexcept
+         {
+            handle.promise().continuation = caller;
+            return handle;
+         }
+
+         T
+         await_resume()
+         {
+            if (!handle)
+               throw std::logic_error("co_await on an empty Task");
+            return handle.promise().Result();
+         }
+      };
+      return Awaiter{handle};
+   }
+};
+
+template<typename T>
+inline Task<T>
+internal::TaskPromise<T>::get_return_object()
+{
+   return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void>
+internal::TaskPromise<void>::get_return_object()
+{
+   return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+//
+// co_await ResumeOn(scheduler) continues the coroutine on that scheduler.
+// If it cannot be scheduled, err is set and the coroutine continues on
+// the current thread.
+//
+class ResumeOnAwaiter
+{
+   Scheduler &scheduler;
+   error *err;
+   SchedulePriority priority;
+
+public:
+   ResumeOnAwaiter(Scheduler &scheduler_, error *err_, SchedulePriority priority_)
+      : scheduler(scheduler_), err(err_), priority(priority_)
+   {
+   }
+
+   bool await_ready() noexcept { return false; }
+
+   bool
+   await_suspend(std::coroutine_handle<> h)
+   {
+      error localErr;
+
+      // Once this succeeds the coroutine may already be running
+      // elsewhere, so nothing after it may touch *this.
+      //
+      scheduler.Schedule(
+         [h] (error *err) -> void { h.resume(); },
+         &localErr,
+         nullptr,
+         priority
+      );
+      if (!ERROR_FAILED(&localErr))
+         return true;
+
+      if (err)
+         internal::MoveError(err, &localErr);
+      return false;
+   }
+
+   void await_resume() noexcept {}
+};
+
+inline ResumeOnAwaiter
+ResumeOn(
+   Scheduler &scheduler,
+   error *err = nullptr,
+   SchedulePriority priority = PriorityNormal
+)
+{
+   return ResumeOnAwaiter(scheduler, err, priority);
+}
+
+//
+// Runs a blocking operation on another scheduler, typically a ThreadPool,
+// and resumes the coroutine there with its result.
+//
+template<typename R>
+class BlockingCallAwaiter
+{
+   Scheduler &scheduler;
+   UniqueFunction<R(error*)> op;
+   error *err;
+   error opErr;
+   R result;
+
+public:
+   BlockingCallAwaiter(Scheduler &scheduler_, UniqueFunction<R(error*)> &&op_, error *err_)
+      : scheduler(scheduler_), op(std::move(op_)), err(err_), result()
+   {
+   }
+
+   bool await_ready() noexcept { return false; }
+
+   bool
+   await_suspend(std::coroutine_handle<> h)
+   {
+      error localErr;
+
+      scheduler.Schedule(
+         [this, h] (error *) -> void
+         {
+            result = op(&opErr);
+            h.resume();
+         },
+         &localErr
+      );
+      if (!ERROR_FAILED(&localErr))
+         return true;
+
+      internal::MoveError(&opErr, &localErr);
+      return false;
+   }
+
+   R
+   await_resume()
+   {
+      if (ERROR_FAILED(&opErr) && err)
+         internal::MoveError(err, &opErr);
+      return result;
+   }
+};
+
+inline BlockingCallAwaiter<size_t>
+ReadAsync(Stream *stream, void *buf, size_t len, Scheduler &io, error *err)
+{
+   Pointer<Stream> s = stream;
+   return BlockingCallAwaiter<size_t>(
+      io,
+      [s, buf, len] (error *err) -> size_t { return s->Read(buf, len, err); },
+      err
+   );
+}
+
+inline BlockingCallAwaiter<size_t>
+WriteAsync(Stream *stream, const void *buf, size_t len, Scheduler &io, error *err)
+{
+   Pointer<Stream> s = stream;
+   return BlockingCallAwaiter<size_t>(
+      io,
+      [s, buf, len] (error *err) -> size_t { return s->Write(buf, len, err); },
+      err
+   );
+}
+
+inline BlockingCallAwaiter<size_t>
+ReadAsync(PStream *stream, void *buf, size_t len, uint64_t pos, Scheduler &io, error *err)
+{
+   Pointer<PStream> s = stream;
+   return BlockingCallAwaiter<size_t>(
+      io,
+      [s, buf, len, pos] (error *err) -> size_t { return s->Read(buf, len, pos, err); },
+      err
+   );
+}
+
+inline BlockingCallAwaiter<size_t>
+WriteAsync(PStream *stream, const void *buf, size_t len, uint64_t pos, Scheduler &io, error *err)
+{
+   Pointer<PStream> s = stream;
+   return BlockingCallAwaiter<size_t>(
+      io,
+      [s, buf, len, pos] (error *err) -> size_t { return s->Write(buf, len, pos, err); },
+      err
+   );
+}
+
+} // end namespace
+
+#endif
+#endif
@@ -0,0 +1,220 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_cxx_function_h_
+#define common_cxx_function_h_
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+
+namespace common {
+
+//
+// Like std::function, but move-only, and callables up to InlineSize bytes
+// are stored inline rather than on the heap.  The default size is picked
+// so that a UniqueFunction plus one pointer fills a 64-byte cache line.
+//
+template<typename Sig, size_t InlineSize = 48>
+class UniqueFunction;
+
+template<typename R, typename... Args, size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize>
+{
+   struct Ops
+   {
+      R (*invoke)(void *storage, Args... args);
+      void (*move)(void *dst, void *src);
+      void (*destroy)(void *storage);
+   };
+
+   const Ops *ops;
+   union
+   {
+      void *heap;
+      unsigned char buf[InlineSize];
+   } storage;
+
+   template<typename F>
+   struct IsInline
+   {
+      static const bool value =
+         sizeof(F) <= InlineSize &&
+         alignof(F) <= alignof(void*) &&
+         std::is_nothrow_move_constructible<F>::value;
+   };
+
+   template<typename F>
+   struct InlineOps
+   {
+      static R Invoke(void *p, Args... args)
+      {
+         return (*reinterpret_cast<F*>(p))(std::forward<Args>(args)...);
+      }
+
+      static void Move(void *dst, void *src)
+      {
+         auto &f = *reinterpret_cast<F*>(src);
+         new (dst) F(std::move(f));
+         f.~F();
+      }
+
+      static void Destroy(void *p)
+      {
+         reinterpret_cast<F*>(p)->~F();
+      }
+
+      static const Ops *Get()
+      {
+         static const Ops ops = {Invoke, Move, Destroy};
+         return &ops;
+      }
+   };
+
+   template<typename F>
+   struct HeapOps
+   {
+      static F *&Ptr(void *p) { return *reinterpret_cast<F**>(p); }
+
+      static R Invoke(void *p, Args... args)
+      {
+         return (*Ptr(p))(std::forward<Args>(args)...);
+      }
+
+      static void Move(void *dst, void *src)
+      {
+         Ptr(dst) = Ptr(src);
+         Ptr(src) = nullptr;
+      }
+
+      static void Destroy(void *p)
+      {
+         delete Ptr(p);
+      }
+
+      static const Ops *Get()
+      {
+         static const Ops ops = {Invoke, Move, Destroy};
+         return &ops;
+      }
+   };
+
+   template<typename F>
+   void
+   Construct(F &&fn, std::true_type isInline)
+   {
+      typedef typename std::decay<F>::type T;
+      new (storage.buf) T(std::forward<F>(fn));
+      ops = InlineOps<T>::Get();
+   }
+
+   template<typename F>
+   void
+   Construct(F &&fn, std::false_type isInline)
+   {
+      typedef typename std::decay<F>::type T;
+      storage.heap = new T(std::forward<F>(fn));
+      ops = HeapOps<T>::Get();
+   }
+
+   // Empty std::functions and null function pointers stay empty.
+   //
+   template<typename F>
+   static auto
+   IsNull(const F &fn, int) -> decltype(fn == nullptr)
+   {
+      return fn == nullptr;
+   }
+
+   template<typename F>
+   static bool
+   IsNull(const F &fn, long)
+   {
+      return false;
+   }
+
+   void
+   MoveFrom(UniqueFunction &other)
+   {
+      ops = other.ops;
+      if (ops)
+      {
+         ops->move(storage.buf, other.storage.buf);
+         other.ops = nullptr;
+      }
+   }
+
+public:
+
+   UniqueFunction() : ops(nullptr) {}
+   UniqueFunction(std::nullptr_t) : ops(nullptr) {}
+   UniqueFunction(const UniqueFunction &) = delete;
+   UniqueFunction(UniqueFunction &&other) { MoveFrom(other); }
+
+   // May throw std::bad_alloc if the callable does not fit inline.
+   //
+   template<
+      typename F,
+      typename = typename std::enable_if<
+         !std::is_same<typename std::decay<F>::type, UniqueFunction>::value
+      >::type
+   >
+   UniqueFunction(F &&fn) : ops(nullptr)
+   {
+      typedef typename std::decay<F>::type T;
+      if (IsNull(fn, 0))
+         return;
+      Construct(
+         std::forward<F>(fn),
+         std::integral_constant<bool, IsInline<T>::value>()
+      );
+   }
+
+   ~UniqueFunction() { reset(); }
+
+   UniqueFunction &
+   operator=(UniqueFunction &&other)
+   {
+      if (&other != this)
+      {
+         reset();
+         MoveFrom(other);
+      }
+      return *this;
+   }
+
+   UniqueFunction &
+   operator=(std::nullptr_t)
+   {
+      reset();
+      return *this;
+   }
+
+   void
+   reset()
+   {
+      if (ops)
+      {
+         ops->destroy(storage.buf);
+         ops = nullptr;
+      }
+   }
+
+   explicit operator bool() const { return ops ? true : false; }
+
+   R
+   operator()(Args... args)
+   {
+      return ops->invoke(storage.buf, std::forward<Args>(args)...);
+   }
+};
+
+} // end namespace
+
+#endif
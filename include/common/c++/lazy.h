@@ -0,0 +1,108 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_cxx_lazy_h
+#define common_cxx_lazy_h
+
+#include <common/lazy.h>
+#include <common/error.h>
+
+#include <new>
+
+namespace common {
+
+//
+// A T constructed on first use, stored inline.  Safe to declare at
+// namespace scope: it has no constructor to run at startup.
+//
+// If construction or the initializer fails, Get() returns nullptr and
+// the next call tries again.
+//
+template<typename T>
+class Lazy
+{
+   lazy_init_state state;
+   alignas(T) unsigned char storage[sizeof(T)];
+
+   T *
+   Value()
+   {
+      return reinterpret_cast<T*>(storage);
+   }
+
+   template<typename Fn>
+   struct InitContext
+   {
+      Lazy *lazy;
+      Fn *fn;
+   };
+
+   template<typename Fn>
+   static void
+   Initialize(void *context, error *err)
+   {
+      auto ctx = reinterpret_cast<InitContext<Fn>*>(context);
+      T *p = nullptr;
+
+      try
+      {
+         p = new (ctx->lazy->storage) T();
+      }
+      catch (const std::bad_alloc&)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      (*ctx->fn)(*p, err);
+      ERROR_CHECK(err);
+      p = nullptr;
+   exit:
+      if (p)
+         p->~T();
+   }
+
+public:
+   constexpr Lazy() : state{nullptr}, storage{} {}
+   Lazy(const Lazy &) = delete;
+
+   ~Lazy()
+   {
+      if (lazy_is_initialized(&state))
+         Value()->~T();
+   }
+
+   // Default-constructs the value, then runs fn(T&, error*) on it.
+   //
+   template<typename Fn>
+   T *
+   Get(Fn fn, error *err)
+   {
+      InitContext<Fn> ctx = {this, &fn};
+
+      lazy_init(&state, Initialize<Fn>, &ctx, err);
+      ERROR_CHECK(err);
+   exit:
+      return ERROR_FAILED(err) ? nullptr : Value();
+   }
+
+   T *
+   Get(error *err)
+   {
+      return Get([] (T &, error *) -> void {}, err);
+   }
+
+   bool
+   IsInitialized()
+   {
+      return lazy_is_initialized(&state);
+   }
+};
+
+} // end namespace
+
+#endif
@@ -18,17 +18,31 @@ namespace common {
 class LineReader
 {
    common::Pointer<common::Stream> stream;
-   char buf[1024];
+   std::vector<char> buf;
+   size_t bufSize;
    size_t off;
    size_t inBuf;
-   std::vector<unsigned char> lineBuf;
+
+   // Lines too long for buf are collected here.
+   //
+   std::vector<char> lineBuf;
+
+   size_t
+   Fill(error *err);
+
 public:
-   LineReader(common::Stream *str);
+   enum { DefaultBufferSize = 64 * 1024 };
+
+   LineReader(common::Stream *str, size_t bufferSize = DefaultBufferSize);
    LineReader(const LineReader &) = delete;
 
    int
    ReadChar(error *err);
 
+   // Returns the next line, without its LF, CRLF or CR terminator, or
+   // nullptr at the end of the stream.  The line may point into the
+   // reader's buffer, and is good until the next call.
+   //
    char *
    ReadLine(error *err);
 };
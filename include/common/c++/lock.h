@@ -11,6 +11,7 @@
 
 #include <common/thread.h>
 #include <common/rwlock.h>
+#include <common/rwlock-biased.h>
 #include <functional>
 #include <mutex>
 #include <new>
@@ -133,6 +134,23 @@ public:
       });
    }
 
+   void acquire(rwlock_biased &m)
+   {
+      release();
+      rwlock_biased_acquire_exclusive(&m);
+      acquire(&m, [] (void* p) -> void
+      {
+         auto q = (rwlock_biased*)p;
+         rwlock_biased_release_exclusive(q);
+      });
+   }
+
+   void acquire_shared(rwlock_biased &m)
+   {
+      release();
+      acquire(rwlock_biased_acquire_shared(&m), rwlock_biased_release_shared);
+   }
+
 #if defined(_WINDOWS)
    void acquire(PCRITICAL_SECTION lock)
    {
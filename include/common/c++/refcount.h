@@ -40,7 +40,10 @@ public:
    virtual ~RefCountable();
 
    void
-   AddRef(void);
+   AddRef(void)
+   {
+      refcnt_inc_inline(&ref);
+   }
 
    bool
    Release(void);
@@ -73,7 +76,7 @@ public:
    Pointer() : ptr(nullptr) {}
    ~Pointer() { Release(); }
    Pointer(const Pointer<T> &other) : ptr(other.ptr) { AddRef(); }
-   Pointer(Pointer<T> &&other) : ptr(other.ptr) { other.ptr = nullptr; }
+   Pointer(Pointer<T> &&other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
 
    Pointer(T* p) : ptr(p) { AddRef(); }
 
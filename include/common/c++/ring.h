@@ -6,73 +6,320 @@
  copyright notice and this permission notice appear in all copies.
 */
 
-#ifndef common_ring_h_
-#define common_ring_h_
-
-#include "../cas.h"
-#include "../misc.h"
-
-namespace common
-{
-
-template<typename T, int bits = 8>
-class RingBuffer
-{
-   T buffer[1 << bits];
-   volatile int reader, writer;
-
-   int Mod(int offset)
-   {
-      return offset & (ARRAY_SIZE(buffer) - 1);
-   }
-public:
-
-   RingBuffer() : reader(0), writer(0) {}
-
-   bool IsEmpty() const { return reader == writer; }
-
-   int
-   Write(T *input, int n)
-   {
-      int o = writer, i = reader;
-      int r = 0;
-      while (n && Mod(o+1) != i)
-      {
-         buffer[o] = std::move(*input++);
-         --n;
-         ++r;
-         o = Mod(o+1);
-      }
-      if (r)
-      {
-         memory_barrier();
-         writer = o;
-      }
-      return r;
-   }
-
-   int
-   Read(T *output, int n)
-   {
-      int r = 0;
-      int o = writer, i = reader;
-      if (i != o)
-      {
-         memory_barrier();
-         while (n && i != o)
-         {
-            *output++ = std::move(buffer[i]);
-            i = Mod(i+1);
-            --n;
-            ++r;
-         }
-      }
-      if (r)
-         reader = i;
-      return r;
-   }
-};
-
-} // end namespace
-
-#endif
+#ifndef common_ring_h_
+#define common_ring_h_
+
+#include "../cas.h"
+#include "../error.h"
+#include "../misc.h"
+
+#include <atomic>
+#include <new>
+
+namespace common
+{
+
+namespace internal
+{
+
+enum { CacheLineSize = 64 };
+
+// Ring storage whose size is fixed at compile time.
+//
+template<typename T, int bits>
+class FixedRingStorage
+{
+   T buffer[1 << bits];
+public:
+   T *Data() { return buffer; }
+   const T *Data() const { return buffer; }
+   static unsigned Mask() { return ARRAY_SIZE(buffer) - 1; }
+};
+
+// Ring storage sized at runtime by Allocate(), rounded up to a power of
+// two.
+//
+template<typename T>
+class DynamicRingStorage
+{
+   T *buffer;
+   unsigned mask;
+public:
+   DynamicRingStorage() : buffer(nullptr), mask(0) {}
+   DynamicRingStorage(const DynamicRingStorage &) = delete;
+   ~DynamicRingStorage() { delete [] buffer; }
+
+   T *Data() { return buffer; }
+   const T *Data() const { return buffer; }
+   unsigned Mask() const { return mask; }
+
+   void
+   Allocate(int capacity, error *err)
+   {
+      unsigned n = 2;
+      T *p = nullptr;
+
+      while (n < (unsigned)capacity && n < (1U << 30))
+         n <<= 1;
+
+      try
+      {
+         p = new T[n];
+      }
+      catch (const std::bad_alloc&)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      delete [] buffer;
+      buffer = p;
+      mask = n - 1;
+   exit:;
+   }
+};
+
+//
+// Single producer, single consumer.
+//
+// Positions count up freely and are masked on access.  Each side keeps a
+// cached copy of the other's position on its own cache line, and only
+// reloads it when the cached value says the ring is full (or empty).
+//
+template<typename T, typename Storage>
+class SpscRing
+{
+protected:
+   Storage storage;
+
+private:
+   char pad0[CacheLineSize];
+   std::atomic<unsigned> reader;
+   unsigned writerCache;
+   char pad1[CacheLineSize - sizeof(std::atomic<unsigned>) - sizeof(unsigned)];
+   std::atomic<unsigned> writer;
+   unsigned readerCache;
+   char pad2[CacheLineSize - sizeof(std::atomic<unsigned>) - sizeof(unsigned)];
+
+public:
+
+   SpscRing() : reader(0), writerCache(0), writer(0), readerCache(0) {}
+   SpscRing(const SpscRing &) = delete;
+
+   bool
+   IsEmpty() const
+   {
+      return reader.load(std::memory_order_acquire) ==
+             writer.load(std::memory_order_acquire);
+   }
+
+   int
+   Write(T *input, int n)
+   {
+      T *buffer = storage.Data();
+      unsigned mask = storage.Mask();
+      unsigned o = writer.load(std::memory_order_relaxed);
+      unsigned avail = mask + 1 - (o - readerCache);
+      int r = 0;
+
+      if (avail < (unsigned)n)
+      {
+         readerCache = reader.load(std::memory_order_acquire);
+         avail = mask + 1 - (o - readerCache);
+      }
+
+      r = MIN((unsigned)n, avail);
+      for (int j=0; j<r; ++j)
+         buffer[(o + j) & mask] = std::move(input[j]);
+      if (r)
+         writer.store(o + r, std::memory_order_release);
+      return r;
+   }
+
+   int
+   Read(T *output, int n)
+   {
+      T *buffer = storage.Data();
+      unsigned mask = storage.Mask();
+      unsigned i = reader.load(std::memory_order_relaxed);
+      unsigned avail = writerCache - i;
+      int r = 0;
+
+      if (avail < (unsigned)n)
+      {
+         writerCache = writer.load(std::memory_order_acquire);
+         avail = writerCache - i;
+      }
+
+      r = MIN((unsigned)n, avail);
+      for (int j=0; j<r; ++j)
+         output[j] = std::move(buffer[(i + j) & mask]);
+      if (r)
+         reader.store(i + r, std::memory_order_release);
+      return r;
+   }
+};
+
+template<typename T>
+struct MpscSlot
+{
+   std::atomic<unsigned> seq;
+   T value;
+
+   MpscSlot() : seq(0) {}
+};
+
+//
+// Multiple producers, single consumer.
+//
+// Producers claim a run of slots by advancing the write position with a
+// single compare-and-swap, then publish each slot individually.  The
+// consumer stops at the first unpublished slot, so items are read in the
+// order their slots were claimed, and each producer's writes stay in order.
+//
+template<typename T, typename Storage>
+class MpscRing
+{
+protected:
+   Storage storage;
+
+private:
+   char pad0[CacheLineSize];
+   std::atomic<unsigned> reader;
+   char pad1[CacheLineSize - sizeof(std::atomic<unsigned>)];
+   std::atomic<unsigned> writer;
+   char pad2[CacheLineSize - sizeof(std::atomic<unsigned>)];
+
+public:
+
+   MpscRing() : reader(0), writer(0) {}
+   MpscRing(const MpscRing &) = delete;
+
+   // True unless the next slot to read has been published, the same test
+   // Read() uses.  A slot that has been claimed but not yet published
+   // counts as empty; its producer signals the consumer afterwards.
+   //
+   // Only meaningful on the consumer's thread.
+   //
+   bool
+   IsEmpty() const
+   {
+      unsigned i = reader.load(std::memory_order_relaxed);
+      auto &slot = storage.Data()[i & storage.Mask()];
+
+      return slot.seq.load(std::memory_order_acquire) != i + 1;
+   }
+
+   // Claims up to n slots with one compare-and-swap and calls
+   // fill(slot, j) to populate the j'th of them.  Returns the number of
+   // slots filled.
+   //
+   template<typename Fill>
+   int
+   Write(int n, Fill fill)
+   {
+      auto buffer = storage.Data();
+      unsigned size = storage.Mask() + 1;
+      unsigned o = writer.load(std::memory_order_relaxed);
+      int r = 0;
+
+      do
+      {
+         unsigned i = reader.load(std::memory_order_acquire);
+         unsigned avail = size - (o - i);
+
+         // A stale write position may appear to be behind the reader;
+         // the compare-and-swap below will reject it.
+         //
+         r = (avail > size) ? n : MIN((unsigned)n, avail);
+         if (!r)
+            return 0;
+      } while (!writer.compare_exchange_weak(o, o + r, std::memory_order_relaxed));
+
+      for (int j=0; j<r; ++j)
+      {
+         auto &slot = buffer[(o + j) & (size - 1)];
+         fill(slot.value, j);
+         slot.seq.store(o + j + 1, std::memory_order_release);
+      }
+
+      return r;
+   }
+
+   int
+   Write(T *input, int n)
+   {
+      return Write(n, [input] (T &slot, int j) -> void { slot = std::move(input[j]); });
+   }
+
+   // Only one thread may call this at a time.
+   //
+   int
+   Read(T *output, int n)
+   {
+      auto buffer = storage.Data();
+      unsigned mask = storage.Mask();
+      unsigned i = reader.load(std::memory_order_relaxed);
+      int r = 0;
+
+      while (r < n)
+      {
+         auto &slot = buffer[i & mask];
+         if (slot.seq.load(std::memory_order_acquire) != i + 1)
+            break;
+         *output++ = std::move(slot.value);
+         ++i;
+         ++r;
+      }
+      if (r)
+         reader.store(i, std::memory_order_release);
+      return r;
+   }
+};
+
+} // end namespace
+
+template<typename T, int bits = 8>
+class RingBuffer
+   : public internal::SpscRing<T, internal::FixedRingStorage<T, bits>>
+{
+};
+
+// A RingBuffer whose capacity is chosen at runtime.  Initialize() must be
+// called before use.
+//
+template<typename T>
+class DynamicRingBuffer
+   : public internal::SpscRing<T, internal::DynamicRingStorage<T>>
+{
+public:
+   void
+   Initialize(int capacity, error *err)
+   {
+      this->storage.Allocate(capacity, err);
+   }
+};
+
+template<typename T, int bits = 8>
+class MpscRingBuffer
+   : public internal::MpscRing<T, internal::FixedRingStorage<internal::MpscSlot<T>, bits>>
+{
+};
+
+// An MpscRingBuffer whose capacity is chosen at runtime.  Initialize()
+// must be called before use.
+//
+template<typename T>
+class DynamicMpscRingBuffer
+   : public internal::MpscRing<T, internal::DynamicRingStorage<internal::MpscSlot<T>>>
+{
+public:
+   void
+   Initialize(int capacity, error *err)
+   {
+      this->storage.Allocate(capacity, err);
+   }
+};
+
+} // end namespace
+
+#endif
@@ -10,54 +10,142 @@
 #define common_sched_h_
 
 #include "../error.h"
+#include "function.h"
 #include <functional>
+#include <utility>
 
 namespace common {
 
+enum SchedulePriority
+{
+   PriorityHigh,
+   PriorityNormal,
+   PriorityBackground,
+};
+
 struct Scheduler
 {
    Scheduler() {}
    Scheduler(const Scheduler &p) = delete;
    virtual ~Scheduler();
 
+   template<typename Fn>
    void
    Schedule(
-      const std::function<void(error*)> &func,
+      Fn &&func,
       bool synchronous,
       error *err,
-      error *asyncErr = nullptr
+      error *asyncErr = nullptr,
+      SchedulePriority priority = PriorityNormal
    )
    {
-      ScheduleImpl(func, synchronous, err, asyncErr);
+      ScheduleImpl(
+         UniqueFunction<void(error*)>(std::forward<Fn>(func)),
+         synchronous,
+         err,
+         asyncErr,
+         priority
+      );
    }
 
+   template<typename Fn>
    void
    Schedule(
-      const std::function<void(error*)> &func,
+      Fn &&func,
       error *err = nullptr,
-      error *asyncErr = nullptr
+      error *asyncErr = nullptr,
+      SchedulePriority priority = PriorityNormal
+   )
+   {
+      ScheduleImpl(
+         UniqueFunction<void(error*)>(std::forward<Fn>(func)),
+         false,
+         err,
+         asyncErr,
+         priority
+      );
+   }
+
+   // Schedules count functions asynchronously, in order.  The functions
+   // are moved from.  Schedulers that can will queue the whole batch at
+   // once with a single wakeup.  On failure, some prefix of the batch may
+   // already have been scheduled.
+   //
+   void
+   ScheduleBatch(
+      UniqueFunction<void(error*)> *funcs,
+      int count,
+      error *err,
+      error *asyncErr = nullptr,
+      SchedulePriority priority = PriorityNormal
    )
    {
-      ScheduleImpl(func, false, err, asyncErr);
+      ScheduleBatchImpl(funcs, count, err, asyncErr, priority);
    }
 
+   // Runs func via an asynchronous schedule function and waits for it to
+   // complete.  func is moved into what gets scheduled.  If scheduling
+   // fails, it may still run later, on its own.
+   //
    static void
    ScheduleSyncViaAsync(
-      const std::function<void(error*)> &func,
-      std::function<void(const std::function<void(error*)> &, error *)> schedule,
+      UniqueFunction<void(error*)> &func,
+      const std::function<void(UniqueFunction<void(error*)> &&, error *)> &schedule,
       error *err
    );
 
 protected:
 
+   // A scheduled function bound to its error context, as it sits in a
+   // queue.  If asyncErr is NULL, errors raised by the function are
+   // discarded.  Fits in one 64-byte cache line.
+   //
+   struct QueuedFunction
+   {
+      UniqueFunction<void(error*)> fn;
+      error *asyncErr;
+
+      QueuedFunction() : asyncErr(nullptr) {}
+
+      QueuedFunction(UniqueFunction<void(error*)> &&fn_, error *asyncErr_)
+         : fn(std::move(fn_)), asyncErr(asyncErr_)
+      {
+      }
+
+      void
+      operator()()
+      {
+         if (asyncErr)
+            fn(asyncErr);
+         else
+         {
+            error err;
+            fn(&err);
+         }
+      }
+   };
+
+   // Schedulers are free to ignore priority, or to treat it only as a
+   // hint.
+   //
    virtual void
    ScheduleImpl(
-      const std::function<void(error*)> &func,
+      UniqueFunction<void(error*)> &&func,
       bool synchronous,
       error *err,
-      error *asyncErr = nullptr
+      error *asyncErr,
+      SchedulePriority priority
    ) = 0;
 
+   virtual void
+   ScheduleBatchImpl(
+      UniqueFunction<void(error*)> *funcs,
+      int count,
+      error *err,
+      error *asyncErr,
+      SchedulePriority priority
+   );
+
 };
 
 } // end namespace
@@ -10,6 +10,7 @@
 #define common_cpp_stream_h
 
 #include "../error.h"
+#include "function.h"
 #include "refcount.h"
 #include <stdio.h>
 #include <stdint.h>
@@ -22,7 +23,22 @@ struct StreamInfo
    bool IsRemote;
    bool FileSizeKnown;
 
-   StreamInfo() : IsRemote(false), FileSizeKnown(true)
+   // If FileIdKnown, two streams with the same DeviceId and FileId
+   // read the same file, starting at the same offset.
+   //
+   bool FileIdKnown;
+   uint64_t DeviceId;
+   uint64_t FileId;
+
+   // Changes when the file is modified, or when the file is deleted and
+   // its id reused, as best the platform can tell from timestamps and
+   // the size.  Only meaningful if FileIdKnown.
+   //
+   uint64_t FileGeneration;
+
+   StreamInfo()
+      : IsRemote(false), FileSizeKnown(true),
+        FileIdKnown(false), DeviceId(0), FileId(0), FileGeneration(0)
    {
    }
 };
@@ -35,6 +51,40 @@ struct StreamBase : public RefCountable
    virtual void GetStreamInfo(StreamInfo *, error *err) {}
 };
 
+// One buffer in a scatter/gather request.  Laid out like struct iovec,
+// so that it can be passed straight to readv() and friends.
+//
+struct IoVec
+{
+   void *Base;
+   size_t Length;
+};
+
+namespace internal {
+
+// Performs vectored I/O one buffer at a time, stopping at the first short
+// transfer.
+//
+template<typename IOFunc>
+size_t
+IoVecLoop(const IoVec *vec, int count, IOFunc ioFunc, error *err)
+{
+   size_t total = 0;
+
+   for (int i=0; i<count; ++i)
+   {
+      size_t r = ioFunc(vec[i].Base, vec[i].Length, err);
+      ERROR_CHECK(err);
+      total += r;
+      if (r < vec[i].Length)
+         break;
+   }
+exit:
+   return total;
+}
+
+} // end namespace
+
 struct PStream;
 
 struct Stream : public StreamBase
@@ -43,6 +93,12 @@ struct Stream : public StreamBase
    virtual void Seek(int64_t pos, int whence, error *err) = 0;
    virtual size_t Read(void *buf, size_t len, error *err) = 0;
    virtual size_t Write(const void *buf, size_t len, error *err);
+
+   // Vectored I/O.  Like Read() and Write(), these may transfer fewer
+   // bytes than were asked for.  By default they loop over the buffers.
+   //
+   virtual size_t ReadV(const IoVec *vec, int count, error *err);
+   virtual size_t WriteV(const IoVec *vec, int count, error *err);
    virtual void ToPStream(PStream **out, error *err);
    virtual void Substream(uint64_t pos, uint64_t len, Stream **out, error *err);
 };
@@ -52,8 +108,19 @@ enum OpenMode
    ReadOnly,
    ReadWrite,
    ReadWriteCreate,
+
+   // May be or'd into one of the above when opening a PStream, to get an
+   // AsyncPStream.
+   //
+   OpenAsync = 0x100,
 };
 
+inline OpenMode
+operator|(OpenMode a, OpenMode b)
+{
+   return (OpenMode)((int)a | (int)b);
+}
+
 void
 CreateStream(
    const char *filename,
@@ -87,6 +154,47 @@ struct PStream : public StreamBase
    virtual size_t Read(void *buf, size_t len, uint64_t pos, error *err) = 0;
    virtual size_t Write(const void *buf, size_t len, uint64_t pos, error *err);
 
+   virtual size_t ReadV(const IoVec *vec, int count, uint64_t pos, error *err);
+   virtual size_t WriteV(const IoVec *vec, int count, uint64_t pos, error *err);
+
+   struct View
+   {
+      const void *Data;
+      size_t Length;
+
+      // Filled in by the stream, for ReleaseView().
+      //
+      void *Context;
+      void (*Release)(void *context);
+
+      View() : Data(nullptr), Length(0), Context(nullptr), Release(nullptr)
+      {
+      }
+   };
+
+   // Points view at len bytes starting at pos, or fewer at the end of the
+   // stream, like Read().  Streams that already hold the data in memory
+   // point into it; by default it is read into a new buffer.  Either way
+   // the data is read-only, and the view must be given to ReleaseView()
+   // before the stream goes away.
+   //
+   virtual void AcquireView(uint64_t pos, size_t len, View *view, error *err);
+   virtual void ReleaseView(View *view);
+
+   // If reads and writes go straight to a file descriptor, returns it,
+   // and sets offset to where position 0 of the stream is in the file
+   // and limit to how many bytes past that the stream covers.  Otherwise
+   // returns -1.
+   //
+   virtual int GetFileDescriptor(uint64_t *offset, uint64_t *limit);
+
+   // Copies up to len bytes from pos to dst at dstPos, stopping early at
+   // the end of this stream, and returns how many were copied.  By default
+   // this goes through a buffer; streams that hold their data in memory
+   // write to dst straight from it.
+   //
+   virtual uint64_t CopyTo(uint64_t pos, uint64_t len, PStream *dst, uint64_t dstPos, error *err);
+
    virtual void ToStream(Stream** out, error *err);
    virtual void Substream(uint64_t pos, uint64_t len, PStream **out, error *err);
 };
@@ -99,6 +207,164 @@ CreateStream(
    error *err
 );
 
+namespace internal {
+
+// Writes all of buf, or fails.
+//
+void
+WriteAll(PStream *dst, const void *buf, size_t len, uint64_t pos, error *err);
+
+} // end namespace
+
+// Like src->CopyTo(), but if both streams are backed by file
+// descriptors, the kernel does the copy.
+//
+uint64_t
+CopyStream(
+   PStream *src,
+   uint64_t srcPos,
+   PStream *dst,
+   uint64_t dstPos,
+   uint64_t len,
+   error *err
+);
+
+class Scheduler;
+
+// Receives the number of bytes transferred, or an error.
+//
+typedef UniqueFunction<void(size_t, error*)> IoCompletion;
+
+//
+// A PStream that can also keep many reads and writes in flight at once.
+// On Linux these go through io_uring; elsewhere, or if the kernel will
+// not allow it, they are run on a pool of threads.
+//
+// If the call to start an operation fails, its callback is never
+// called.  Otherwise the callback runs on the stream's scheduler, or on
+// an internal thread if it has none; in that case it should not block.
+// The buffer must stay valid until then.
+//
+struct AsyncPStream : public PStream
+{
+   virtual void
+   ReadAsync(void *buf, size_t len, uint64_t pos, IoCompletion &&onComplete, error *err) = 0;
+
+   virtual void
+   WriteAsync(const void *buf, size_t len, uint64_t pos, IoCompletion &&onComplete, error *err) = 0;
+};
+
+// Callbacks are delivered on completions, which must outlive the stream.
+//
+void
+CreateStream(
+   const char *filename,
+   OpenMode mode,
+   Scheduler *completions,
+   AsyncPStream **out,
+   error *err
+);
+
+// A read-only PStream backed by a memory mapping of the file.
+//
+// Files that cannot be mapped, such as pipes or files on remote
+// filesystems, are read with pread() instead.  If the file grows it is
+// mapped again; it must not shrink while mapped.
+//
+// Reads inside the current mapping make no system calls.  A read that
+// reaches the end of the file as last seen checks the size once more,
+// and maps the file again if it has grown.
+//
+struct MappedPStream : public PStream
+{
+   // Returns a pointer to len bytes of the file starting at pos, which
+   // stays valid for the life of the stream.  Fails if the range is
+   // past the end of the file, or if the file is not mapped.
+   //
+   virtual const void *GetView(uint64_t pos, size_t len, error *err) = 0;
+};
+
+void
+CreateMappedStream(
+   const char *filename,
+   MappedPStream **out,
+   error *err
+);
+
+inline void
+CreateMappedStream(const char *filename, PStream **out, error *err)
+{
+   MappedPStream *p = nullptr;
+   CreateMappedStream(filename, &p, err);
+   *out = p;
+}
+
+//
+// Wraps a stream with a buffer of bufferSize bytes.  Reads are served
+// from data read ahead into the buffer, and small writes are collected
+// there until Flush(), a Seek() out of the buffer, or a Read().
+//
+// Writes still in the buffer when the stream is released are written
+// then, but errors are lost; call Flush() to find out about them.
+//
+// The stream need not be seekable.  Over a pipe or socket, positions
+// count from 0, the underlying stream is only seeked when Seek() is
+// called, and a write drops anything read ahead, so reads and writes
+// should not be mixed.
+//
+void
+CreateBufferedStream(
+   Stream *stream,
+   size_t bufferSize,
+   Stream **out,
+   error *err
+);
+
+void
+CreateBufferedStream(
+   PStream *stream,
+   size_t bufferSize,
+   Stream **out,
+   error *err
+);
+
+//
+// Wraps a PStream with a cache of 64 KiB blocks, shared by all cached
+// streams in the process and kept in least-recently-used order.  Blocks
+// are keyed by the file's identity from GetStreamInfo(), so two streams
+// over the same file share them, and a block that several threads miss
+// at once is read only once.
+//
+// Writes and truncates through a cached stream go straight to the file
+// and drop the blocks they touch.  Blocks outlive the stream, but are
+// also keyed by the file's timestamps and size when it was opened, so a
+// file replaced or modified since is not served from stale blocks.
+// Changes made by others while a cached stream is open are not seen.
+//
+void
+CreateCachedStream(PStream *stream, PStream **out, error *err);
+
+struct BlockCacheStats
+{
+   uint64_t Hits;
+   uint64_t Misses;
+   uint64_t Evictions;
+   uint64_t BytesCached;
+
+   // Blocks in the cache, including any still being read.  Once reads
+   // have finished, BytesCached is this many 64 KiB blocks.
+   //
+   uint64_t Blocks;
+};
+
+void
+GetBlockCacheStats(BlockCacheStats *stats);
+
+// The default is 64 MiB.
+//
+void
+SetBlockCacheCapacity(size_t bytes);
+
 struct MemoryStreamBuffer
 {
    virtual void *GetBuffer();
@@ -106,8 +372,19 @@ struct MemoryStreamBuffer
    virtual void Resize(size_t sz, error *err);
    virtual ~MemoryStreamBuffer();
 
+   // Returns the bytes at pos, which must be less than GetSize(), and
+   // sets len to how many follow contiguously.  By default this is the
+   // rest of GetBuffer().
+   //
+   virtual void *GetSegment(size_t pos, size_t &len);
+
    bool Writeable;
 
+   // If set, Resize() never moves bytes already in the buffer, so readers
+   // need not lock out a writer growing it.
+   //
+   bool StableAddresses;
+
    MemoryStreamBuffer();
    MemoryStreamBuffer(const MemoryStreamBuffer&) = delete;
 };
@@ -139,6 +416,28 @@ CreateMemoryStreamBuffer(
    error *err
 );
 
+struct MemoryStreamBufferOptions
+{
+   // If nonzero, the buffer is built from chunks of this size, rounded up
+   // to a power of two, instead of one contiguous allocation.  It then
+   // grows without copying and has StableAddresses set, but GetBuffer()
+   // returns nullptr; use GetSegment() instead.
+   //
+   size_t ChunkSize;
+
+   MemoryStreamBufferOptions() : ChunkSize(0)
+   {
+   }
+};
+
+void
+CreateMemoryStreamBuffer(
+   size_t initialSize,
+   const MemoryStreamBufferOptions &options,
+   MemoryStreamBuffer *&obj,
+   error *err
+);
+
 enum MemoryStreamLockSheme
 {
    NoSynchronization,
@@ -146,6 +445,10 @@ enum MemoryStreamLockSheme
    MultipleWriter,
 };
 
+// Views of a memory stream point into its buffer, unless it could move
+// while the view is held.  With NoSynchronization, a view into a
+// contiguous buffer lasts only until the stream next grows.
+//
 void
 CreateMemoryStream(
    MemoryStreamBuffer *&buf,
@@ -0,0 +1,79 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_threadpool_h_
+#define common_threadpool_h_
+
+#include "scheduler.h"
+#include "../thread.h"
+#include "../sem.h"
+
+#include <vector>
+
+namespace common
+{
+
+namespace internal {
+struct ThreadPoolWorker;
+} // end namespace
+
+//
+// A Scheduler backed by several threads.  Each thread owns a queue;
+// functions scheduled from a pool thread go to that thread's queue, others
+// are distributed round-robin.  Idle threads steal from their neighbours.
+//
+// Unlike WorkerThread, no ordering between scheduled functions is
+// guaranteed.  PriorityHigh functions are queued ahead of others; the
+// other priorities are treated alike.
+//
+class ThreadPool : public Scheduler
+{
+   typedef internal::ThreadPoolWorker Worker;
+   friend struct internal::ThreadPoolWorker;
+
+   std::vector<Worker*> workers;
+   semaphore wakeSem;
+   volatile unsigned long idleCount;
+   volatile unsigned long nextWorker;
+   volatile bool stopping;
+
+   void Cleanup(void);
+   void Run(Worker *self);
+   bool Pop(Worker *self, QueuedFunction &fn);
+   bool Steal(Worker *self, QueuedFunction &fn);
+   void Push(QueuedFunction &fn, SchedulePriority priority, error *err);
+   Worker *GetCurrentWorker(void);
+
+protected:
+
+   void
+   ScheduleImpl(
+      UniqueFunction<void(error*)> &&func,
+      bool synchronous,
+      error *err,
+      error *asyncErr,
+      SchedulePriority priority
+   );
+
+public:
+
+   // If nthreads is zero, one thread is created per CPU.
+   //
+   ThreadPool(int nthreads = 0);
+   ~ThreadPool();
+
+   int
+   GetThreadCount(void) const { return workers.size(); }
+
+   bool
+   IsOnThread(void);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_timerwheel_h_
+#define common_timerwheel_h_
+
+#include "function.h"
+#include "refcount.h"
+#include "../error.h"
+
+#include <atomic>
+#include <stdint.h>
+
+namespace common {
+
+class TimerWheel;
+
+//
+// A function scheduled to run at some later time, possibly repeatedly.
+//
+// Cancel() may be called from any thread and takes constant time.  A
+// cancelled timer never runs again, but its function is only destroyed
+// once the wheel reaches the slot it was sitting in.
+//
+class Timer : public RefCountable
+{
+   friend class TimerWheel;
+
+   Timer *next;
+   uint64_t expires;
+   uint64_t period;
+   UniqueFunction<void(error*)> fn;
+   std::atomic<bool> cancelled;
+
+public:
+   Timer(UniqueFunction<void(error*)> &&fn, uint64_t expires, uint64_t period = 0);
+
+   void Cancel(void) { cancelled = true; }
+   bool IsCancelled(void) const { return cancelled; }
+};
+
+//
+// A hierarchical timing wheel with one millisecond ticks: 4 levels of 64
+// slots each, covering about 4.6 hours.  Timers further out than that sit
+// on a separate list which is revisited each time the top level wraps.
+//
+// Not thread safe; all calls must come from the same thread.
+//
+class TimerWheel
+{
+   enum
+   {
+      Levels = 4,
+      SlotBits = 6,
+      Slots = 1 << SlotBits,
+   };
+
+   // Every tick up to and including this one has been processed.
+   //
+   uint64_t current;
+
+   Timer *slots[Levels][Slots];
+   uint64_t occupied[Levels];
+   Timer *far;
+
+   static void ReleaseList(Timer *list);
+
+   void Link(Timer *t);
+   void Cascade(Timer *list, Timer **due);
+   void Fire(Timer *list);
+   uint64_t NextTick(void) const;
+
+public:
+   TimerWheel(uint64_t now);
+   TimerWheel(const TimerWheel &) = delete;
+   ~TimerWheel();
+
+   // The wheel takes a reference to t until it fires for the last time or
+   // is found to be cancelled.
+   //
+   void
+   Insert(Timer *t);
+
+   // Runs the timers due at or before now.
+   //
+   void
+   Advance(uint64_t now);
+
+   // Returns the number of milliseconds until Advance() next has work to
+   // do, or -1 if there are no timers.
+   //
+   int64_t
+   GetTimeout(uint64_t now) const;
+};
+
+} // end namespace
+
+#endif
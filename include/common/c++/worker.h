@@ -11,48 +11,96 @@
 
 #include "scheduler.h"
 #include "ring.h"
+#include "timerwheel.h"
 #include "../thread.h"
 #include "../sem.h"
 
+#include <atomic>
+#include <vector>
+
 namespace common
 {
 
 class WorkerThreadBase : public Scheduler
 {
-   RingBuffer<std::function<void(void)>> queue;
-   mutex producerMutex;
+   // One queue per SchedulePriority.
+   //
+   struct Lane
+   {
+      DynamicMpscRingBuffer<QueuedFunction> queue;
+
+      // When the ring is full, producers fall back to a list under
+      // overflowMutex.  While that list is in use, all producers append
+      // to it, so that nobody's writes can overtake their earlier ones.
+      // The consumer swaps it out and works through it in batches.
+      //
+      std::atomic<bool> overflowing;
+      std::vector<QueuedFunction> overflow;
+      std::vector<QueuedFunction> overflowScratch;
+      size_t overflowPos;
+
+      // Number of consecutive drain passes that skipped this lane while
+      // it had work.
+      //
+      int starved;
+
+      Lane() : overflowing(false), overflowPos(0), starved(0) {}
+
+      bool
+      IsEmpty(void) const { return queue.IsEmpty() && !overflowing; }
+   };
+
+   Lane lanes[PriorityBackground + 1];
+   mutex overflowMutex;
    bool localSignal;
 
-   struct SlowPathQueueNode;
-   SlowPathQueueNode *slowQueueHead;
-   SlowPathQueueNode **slowQueueTail;
-
    void Cleanup();
 
-   std::function<void(void)>
-   PrepFunction(const std::function<void(error*)> &fn, error *asyncErr);
-
-   void Write(std::function<void(void)> &fn, error *err);
-   void SlowQueueChomp();
+   Lane &GetLane(SchedulePriority priority);
+   void Write(Lane &lane, QueuedFunction &fn, error *err);
+   void WriteBatch(
+      Lane &lane,
+      UniqueFunction<void(error*)> *funcs,
+      int count,
+      error *asyncErr,
+      error *err
+   );
+   void RunBatch(Lane &lane, QueuedFunction *funcs, int nfuncs);
 
 protected:
 
    bool IsEmpty(void);
-   void Drain(std::function<void(void)> *funcs, int nfuncs);
+   void Drain(QueuedFunction *funcs, int nfuncs);
 
    virtual bool IsOnThread(void) = 0;
    virtual void Signal(error *err) = 0;
 
    void
    ScheduleImpl(
-      const std::function<void(error*)> &func,
+      UniqueFunction<void(error*)> &&func,
       bool synchronous,
       error *err,
-      error *asyncErr
+      error *asyncErr,
+      SchedulePriority priority
+   );
+
+   void
+   ScheduleBatchImpl(
+      UniqueFunction<void(error*)> *funcs,
+      int count,
+      error *err,
+      error *asyncErr,
+      SchedulePriority priority
    );
 
 public:
-   WorkerThreadBase();
+   enum { DefaultQueueDepth = 256 };
+
+   // queueDepth is the number of functions each priority's ring holds
+   // before producers spill onto a slower locked list.  It is rounded up
+   // to a power of two.
+   //
+   WorkerThreadBase(int queueDepth = DefaultQueueDepth);
    ~WorkerThreadBase();
 };
 
@@ -62,7 +110,27 @@ class WorkerThread : public WorkerThreadBase
    semaphore consumerSem;
    volatile bool stopping;
 
+   // Set while the consumer is, or is about to be, blocked on consumerSem.
+   // Producers only post the semaphore when they are the one to clear it.
+   //
+   std::atomic<bool> parked;
+   int spinCount;
+
+   // Only touched on the worker thread.
+   //
+   TimerWheel timers;
+
    void Cleanup(void);
+   void Park(int64_t timeoutMillis);
+
+   void
+   AddTimer(
+      uint64_t delayMillis,
+      uint64_t periodMillis,
+      UniqueFunction<void(error*)> &&func,
+      Timer **timer,
+      error *err
+   );
 
 protected:
 
@@ -71,8 +139,37 @@ protected:
 
 public:
 
-   WorkerThread();
+   WorkerThread(int queueDepth = DefaultQueueDepth);
    ~WorkerThread();
+
+   // Runs func on the worker thread once, after delayMillis.  If timer is
+   // non-NULL, it receives a reference to a handle that can cancel it.
+   // Timers still pending when the WorkerThread is destroyed never run.
+   //
+   void
+   ScheduleAfter(
+      uint64_t delayMillis,
+      UniqueFunction<void(error*)> &&func,
+      Timer **timer = nullptr,
+      error *err = nullptr
+   )
+   {
+      AddTimer(delayMillis, 0, std::move(func), timer, err);
+   }
+
+   // Runs func on the worker thread every periodMillis, starting
+   // periodMillis from now, until cancelled.
+   //
+   void
+   ScheduleEvery(
+      uint64_t periodMillis,
+      UniqueFunction<void(error*)> &&func,
+      Timer **timer = nullptr,
+      error *err = nullptr
+   )
+   {
+      AddTimer(periodMillis, periodMillis ? periodMillis : 1, std::move(func), timer, err);
+   }
 };
 
 } // end namespace
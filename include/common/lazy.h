@@ -17,11 +17,21 @@
 extern "C" {
 #endif
 
+//
+// Zero-initialize, eg. with {0}.  While the initializer runs, the state
+// points to a stack of threads waiting for it to finish.
+//
 typedef struct
 {
-   volatile unsigned long state;
+   void *volatile state;
 } lazy_init_state;
 
+//
+// Runs fn once.  Threads that arrive while it is running wait for it.
+// If it fails, err is set for that caller only, and the next call tries
+// again.
+//
+
 void
 lazy_init(
   lazy_init_state *state,
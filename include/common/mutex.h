@@ -19,6 +19,17 @@
 #define MUTEX_PTHREAD
 #endif
 
+//
+// Building with USE_FUTEX_MUTEX defined replaces pthread_mutex_t on Linux
+// with a lock that spins briefly before sleeping on a futex.  Threads and
+// semaphores still come from pthreads.  It must be defined the same way
+// for the library and everything that uses it.
+//
+
+#if defined(__linux__) && defined(USE_FUTEX_MUTEX)
+#define MUTEX_FUTEX
+#endif
+
 // XXX - we have a name conflict on Solaris.
 #if defined(__sun__)
 #define mutex mutex_sun
@@ -34,14 +45,55 @@ typedef struct
 {
 #if defined(MUTEX_WINDOWS)
    CRITICAL_SECTION CriticalSection;
+#elif defined(MUTEX_FUTEX)
+   // 0 if unlocked, 1 if locked, 2 if locked and there may be sleepers.
+   int state;
+
+   // Tickets, for MUTEX_FAIR.
+   unsigned int next_ticket;
+   unsigned int now_serving;
+
+   int flags;
+
+   // Running estimate of how long spinning takes to succeed.
+   int spin;
+
+   unsigned long contended;
+   unsigned long sleeps;
 #elif defined(MUTEX_PTHREAD)
    pthread_mutex_t m;
 #endif
 } mutex;
 
+enum
+{
+   // Hand the lock to waiters in the order they arrived, rather than to
+   // whoever gets there first.  This avoids starving a waiter, but every
+   // handoff must wait for the next thread in line to be scheduled, which
+   // is slow once threads outnumber CPUs.  Honored by the futex mutex and
+   // on Apple platforms.
+   //
+   MUTEX_FAIR = (1<<0),
+};
+
+struct mutex_stats
+{
+   // Times an acquire found the lock held, and times a thread slept on
+   // it.  Always zero unless built with USE_FUTEX_MUTEX.
+   //
+   unsigned long contended;
+   unsigned long sleeps;
+};
+
 void
 mutex_init(mutex *, error *err);
 
+void
+mutex_init_flags(mutex *, int flags, error *err);
+
+void
+mutex_get_stats(mutex *, struct mutex_stats *stats);
+
 void
 mutex_destroy(mutex *);
 
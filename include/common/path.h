@@ -114,6 +114,22 @@ mkdir_if_not_exists(const char *path, error *err);
 void
 copy_file(const char *src, const char *dst, error *err);
 
+#if !defined(_WINDOWS)
+// Copies len bytes from infd at inoff to outfd at outoff, in the kernel
+// if possible, stopping early at the end of infd.  Neither descriptor's
+// file position is used.  Returns the number of bytes copied.
+//
+uint64_t
+copy_fd_range(
+   int infd,
+   uint64_t inoff,
+   int outfd,
+   uint64_t outoff,
+   uint64_t len,
+   error *err
+);
+#endif
+
 const char *
 get_appname();
 
@@ -9,6 +9,10 @@
 #ifndef refcnt_h
 #define refcnt_h
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -27,6 +31,55 @@ refcnt_inc_unsafe(refcnt *p);
 int
 refcnt_dec_unsafe(refcnt *p);
 
+//
+// Inline versions of refcnt_inc() and refcnt_dec(), for hot paths.
+//
+// Taking a reference needs no ordering, since the caller already holds
+// one.  Dropping one is a release, so that our writes to the object
+// happen before whoever frees it, and the final drop also acquires, so
+// that the free happens after everyone else's.
+//
+
+#if defined(_MSC_VER)
+#define REFCNT_INLINE static __inline
+#define REFCNT_HAVE_INLINE
+#elif defined(__GNUC__) && \
+      !(__GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 7))
+#define REFCNT_INLINE static __inline__
+#define REFCNT_HAVE_INLINE
+#endif
+
+#if defined(REFCNT_HAVE_INLINE)
+
+REFCNT_INLINE
+void
+refcnt_inc_inline(refcnt *p)
+{
+#if defined(_MSC_VER)
+   _InterlockedIncrement((volatile long *)p);
+#else
+   __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+REFCNT_INLINE
+int
+refcnt_dec_inline(refcnt *p)
+{
+#if defined(_MSC_VER)
+   return _InterlockedDecrement((volatile long *)p) == 0;
+#else
+   return __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL) == 0;
+#endif
+}
+
+#else
+#define refcnt_inc_inline refcnt_inc
+#define refcnt_dec_inline refcnt_dec
+#endif
+
+#undef REFCNT_INLINE
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,67 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+//
+// A reader-biased rwlock, after BRAVO (Dice & Kogan, 2019).
+//
+// While the lock is biased, a reader does not touch the lock at all: it
+// claims a slot in a process-wide table, chosen by hashing the lock and
+// the thread, so readers on different threads write different cache
+// lines.  A writer turns the bias off and waits for those slots to
+// empty, which is slow, so the bias stays off for a while afterwards,
+// and readers use the underlying rwlock until it comes back.
+//
+// Good for locks that are read far more often than written.
+//
+
+#ifndef common_rwlock_biased_h_
+#define common_rwlock_biased_h_
+
+#include "rwlock.h"
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct
+{
+   rwlock lock;
+   volatile int rbias;
+
+   // Monotonic time in milliseconds before which readers should not
+   // turn the bias back on.  Only touched with lock held.
+   //
+   uint64_t inhibit_until;
+} rwlock_biased;
+
+void
+rwlock_biased_init(rwlock_biased *lock, error *err);
+
+void
+rwlock_biased_destroy(rwlock_biased *lock);
+
+void
+rwlock_biased_acquire_exclusive(rwlock_biased *lock);
+
+void
+rwlock_biased_release_exclusive(rwlock_biased *lock);
+
+// Returns a token to pass to rwlock_biased_release_shared().
+//
+void *
+rwlock_biased_acquire_shared(rwlock_biased *lock);
+
+void
+rwlock_biased_release_shared(void *token);
+
+#if defined(__cplusplus)
+}
+#endif
+#endif
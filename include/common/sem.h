@@ -10,6 +10,7 @@
 #define semaphore_h
 
 #include "mutex.h"
+#include <stdbool.h>
 
 #if defined(__APPLE__)
 #define SEMAPHORE_LIBDISPATCH
@@ -61,6 +62,12 @@ sm_wait(semaphore *);
 void
 sm_post(semaphore *);
 
+// Returns true if the semaphore was acquired, false if the timeout
+// elapsed first.
+//
+bool
+sm_timed_wait(semaphore *, int millis);
+
 #if defined(__cplusplus)
 }
 #endif
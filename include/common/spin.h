@@ -30,4 +30,20 @@
 #define spin() usleep(1)
 #endif
 
+//
+// spin_pause() is for busy-wait loops that expect to succeed within a few
+// microseconds: it tells the CPU we are spinning without giving up the
+// time slice.
+//
+
+#if defined(_WINDOWS)
+#define spin_pause() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define spin_pause() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define spin_pause() __asm__ __volatile__("yield")
+#else
+#define spin_pause() ((void)0)
+#endif
+
 #endif
\ No newline at end of file
@@ -63,6 +63,11 @@ thread_get_self(thread_id *id);
 bool
 thread_is_started(thread_id *id);
 
+// Returns the number of online processors, at least 1.
+//
+int
+get_cpu_count(void);
+
 #if defined(__cplusplus)
 }
 
@@ -26,9 +26,13 @@ struct waiter_node
    struct waiter_node *next;
 
    // First attempt will be to use a proper kernel wait primitive.
+   // On Linux that is a futex on this word, which needs no setup and
+   // cannot fail, so the spin below is never used.
    //
 #if defined(_WINDOWS)
    HANDLE event;
+#elif defined(__linux__)
+   int futex;
 #else
    int pipe[2];
 #endif
@@ -51,6 +55,14 @@ waiter_node_signal(struct waiter_node *node);
 void
 waiter_node_wait(struct waiter_node *node);
 
+// Returns true if the node was signaled, false if the timeout elapsed
+// first.  In that case a signal may still come later, so take the node
+// out of any queue a signaler could find it in before destroying it, or
+// if that fails, wait for the signal.
+//
+bool
+waiter_node_timed_wait(struct waiter_node *node, int millis);
+
 typedef
 struct waiter_node *
 waiter_node_queue;
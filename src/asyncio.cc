@@ -0,0 +1,531 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include "asyncio.h"
+
+#include <common/c++/lock.h>
+#include <common/c++/threadpool.h>
+#include <common/lazy.h>
+#include <common/misc.h>
+#include <common/mutex.h>
+#include <common/thread.h>
+
+#include <atomic>
+#include <new>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace common;
+using common::internal::AsyncIoRequest;
+
+void
+common::internal::AsyncIoRequest::Complete(void)
+{
+   if (scheduler)
+   {
+      error scheduleErr;
+
+      scheduler->Schedule(
+         [this] (error *) -> void
+         {
+            callback(result, &err);
+            delete this;
+         },
+         &scheduleErr
+      );
+      if (!ERROR_FAILED(&scheduleErr))
+         return;
+      ERROR_LOG(&scheduleErr);
+   }
+
+   callback(result, &err);
+   delete this;
+}
+
+namespace {
+
+void
+RunBlocking(AsyncIoRequest *req)
+{
+   if (req->write)
+      req->result = req->stream->Write(req->buf, req->len, req->pos, &req->err);
+   else
+      req->result = req->stream->Read(req->buf, req->len, req->pos, &req->err);
+}
+
+#if defined(HAVE_IO_URING)
+
+//
+// One ring shared by every asynchronous stream in the process, with one
+// thread reaping completions.  Like the fallback pool, it lives until the
+// process exits.
+//
+class IoUring
+{
+   enum { Entries = 256 };
+
+   int fd;
+
+   unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+   struct io_uring_sqe *sqes;
+   unsigned *cqHead, *cqTail, *cqMask;
+   struct io_uring_cqe *cqes;
+
+   void *sqRing;
+   size_t sqRingSize;
+   void *cqRing;
+   size_t cqRingSize;
+   size_t sqesSize;
+
+   // Serializes submitters filling in the submission queue, and guards
+   // inFlight and stopped.
+   //
+   mutex submitLock;
+
+   // Every request handed to the ring and not yet completed, so that
+   // they can be failed if the ring stops working.
+   //
+   AsyncIoRequest *inFlight;
+
+   // Set once the kernel has refused to let us wait on the ring.  Submit()
+   // then turns everything away, and the pool takes it.
+   //
+   bool stopped;
+
+   // Requests started from completion callbacks are left in the
+   // submission queue, and handed to the kernel together when the reaper
+   // next waits.
+   //
+   static thread_local bool onReaper;
+
+   thread_id reaper;
+
+   static int
+   Setup(unsigned entries, struct io_uring_params *p)
+   {
+      return syscall(__NR_io_uring_setup, entries, p);
+   }
+
+   int
+   Enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+   {
+      return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+   }
+
+   static unsigned
+   LoadAcquire(unsigned *p)
+   {
+      return reinterpret_cast<std::atomic<unsigned>*>(p)->load(std::memory_order_acquire);
+   }
+
+   static void
+   StoreRelease(unsigned *p, unsigned value)
+   {
+      reinterpret_cast<std::atomic<unsigned>*>(p)->store(value, std::memory_order_release);
+   }
+
+   static unsigned
+   Pending(unsigned *head, unsigned *tail)
+   {
+      return LoadAcquire(tail) - LoadAcquire(head);
+   }
+
+   // Hands the kernel whatever is in the submission queue.
+   //
+   void
+   Flush(void)
+   {
+      unsigned pending = Pending(sqHead, sqTail);
+      int r = 0;
+
+      if (!pending)
+         return;
+
+      while ((r = Enter(pending, 0, 0)) < 0 && errno == EINTR)
+         ;
+
+      // EAGAIN and EBUSY mean the kernel is short on memory or on room
+      // for completions.  Whatever it did not take goes with the reaper's
+      // next call.
+      //
+      if (r < 0 && errno != EAGAIN && errno != EBUSY)
+      {
+         error err;
+         error_set_errno(&err, errno);
+         ERROR_LOG(&err);
+      }
+   }
+
+   // Caller holds submitLock.
+   //
+   void
+   Unlink(AsyncIoRequest *req)
+   {
+      if (req->prev)
+         req->prev->next = req->next;
+      else
+         inFlight = req->next;
+      if (req->next)
+         req->next->prev = req->prev;
+      req->prev = req->next = nullptr;
+   }
+
+   // Runs the callbacks for everything in the completion queue.
+   //
+   void
+   ReapCompletions(void)
+   {
+      common::locker l;
+      unsigned head = *cqHead;
+      unsigned tail = LoadAcquire(cqTail);
+
+      if (head == tail)
+         return;
+
+      // Take the whole batch off the list with one trip through the lock.
+      //
+      l.acquire(submitLock);
+      for (unsigned i = head; i != tail; ++i)
+         Unlink(reinterpret_cast<AsyncIoRequest*>(cqes[i & *cqMask].user_data));
+      l.release();
+
+      while (head != tail)
+      {
+         auto cqe = &cqes[head & *cqMask];
+         auto req = reinterpret_cast<AsyncIoRequest*>(cqe->user_data);
+
+         if (cqe->res < 0)
+            error_set_errno(&req->err, -cqe->res);
+         else
+            req->result = cqe->res;
+
+         StoreRelease(cqHead, ++head);
+         req->Complete();
+      }
+   }
+
+   // The kernel will not let us wait for completions any more.  Turn
+   // away new requests, deliver what has already completed, and fail the
+   // rest with errno_value, since we have no other way to hear about them.
+   //
+   void
+   Stop(int errno_value)
+   {
+      common::locker l;
+      AsyncIoRequest *req = nullptr;
+
+      l.acquire(submitLock);
+      stopped = true;
+      l.release();
+
+      ReapCompletions();
+
+      l.acquire(submitLock);
+      req = inFlight;
+      inFlight = nullptr;
+      l.release();
+
+      while (req)
+      {
+         auto next = req->next;
+         req->prev = req->next = nullptr;
+         error_set_errno(&req->err, errno_value);
+         req->Complete();
+         req = next;
+      }
+   }
+
+   void
+   Reap(void)
+   {
+      onReaper = true;
+
+      for (;;)
+      {
+         // EAGAIN and EBUSY are the kernel being short on memory or on
+         // room for completions, and pass.  Anything else, such as EBADF,
+         // will fail the same way every time.
+         //
+         if (Enter(Pending(sqHead, sqTail), 1, IORING_ENTER_GETEVENTS) < 0 &&
+             errno != EINTR && errno != EAGAIN && errno != EBUSY)
+         {
+            int code = errno;
+            error err;
+            error_set_errno(&err, code);
+            ERROR_LOG(&err);
+            Stop(code);
+            return;
+         }
+
+         ReapCompletions();
+      }
+   }
+
+public:
+
+   IoUring()
+      : fd(-1),
+        sqes((struct io_uring_sqe*)MAP_FAILED),
+        sqRing(MAP_FAILED), sqRingSize(0),
+        cqRing(MAP_FAILED), cqRingSize(0),
+        sqesSize(0),
+        inFlight(nullptr),
+        stopped(false)
+   {
+      memset(&submitLock, 0, sizeof(submitLock));
+      memset(&reaper, 0, sizeof(reaper));
+   }
+
+   // Only reached if Initialize() fails; a working ring is never freed,
+   // even once stopped.
+   //
+   ~IoUring()
+   {
+      if (sqes != MAP_FAILED)
+         munmap(sqes, sqesSize);
+      if (cqRing != MAP_FAILED && cqRing != sqRing)
+         munmap(cqRing, cqRingSize);
+      if (sqRing != MAP_FAILED)
+         munmap(sqRing, sqRingSize);
+      if (fd >= 0)
+         close(fd);
+      mutex_destroy(&submitLock);
+   }
+
+   // Returns false, without setting err, if the kernel does not support
+   // io_uring or will not let us use it.
+   //
+   bool
+   Initialize(error *err)
+   {
+      struct io_uring_params p;
+      bool r = false;
+      char *sq, *cq;
+
+      memset(&p, 0, sizeof(p));
+
+      fd = Setup(Entries, &p);
+      if (fd < 0)
+         goto exit;
+
+      // Without this, completions beyond what the queue holds are lost.
+      // With it, we never need to limit how many requests are in flight.
+      //
+      if (!(p.features & IORING_FEAT_NODROP))
+         goto exit;
+
+      sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+         sqRingSize = cqRingSize = MAX(sqRingSize, cqRingSize);
+
+      sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if (sqRing == MAP_FAILED)
+         goto exit;
+
+      if (p.features & IORING_FEAT_SINGLE_MMAP)
+      {
+         cqRing = sqRing;
+      }
+      else
+      {
+         cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+         if (cqRing == MAP_FAILED)
+            goto exit;
+      }
+
+      sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+      sqes = (struct io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+      if (sqes == MAP_FAILED)
+         goto exit;
+
+      sq = (char*)sqRing;
+      sqHead  = (unsigned*)(sq + p.sq_off.head);
+      sqTail  = (unsigned*)(sq + p.sq_off.tail);
+      sqMask  = (unsigned*)(sq + p.sq_off.ring_mask);
+      sqArray = (unsigned*)(sq + p.sq_off.array);
+
+      cq = (char*)cqRing;
+      cqHead = (unsigned*)(cq + p.cq_off.head);
+      cqTail = (unsigned*)(cq + p.cq_off.tail);
+      cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+      cqes   = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+      mutex_init(&submitLock, err);
+      ERROR_CHECK(err);
+
+      common::create_thread([this] () -> void { Reap(); }, &reaper, err);
+      ERROR_CHECK(err);
+      detach_thread(&reaper);
+
+      r = true;
+   exit:
+      return r;
+   }
+
+   // Returns false if the submission queue is full, or the ring has
+   // stopped.
+   //
+   bool
+   Submit(AsyncIoRequest *req)
+   {
+      common::locker l;
+      unsigned tail, idx;
+      struct io_uring_sqe *sqe;
+      bool accepted = false;
+
+      l.acquire(submitLock);
+
+      if (stopped)
+         goto exit;
+
+      if (Pending(sqHead, sqTail) > *sqMask)
+      {
+         Flush();
+         if (Pending(sqHead, sqTail) > *sqMask)
+            goto exit;
+      }
+
+      tail = *sqTail;
+      idx = tail & *sqMask;
+      sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      req->vec.Base = req->buf;
+      req->vec.Length = req->len;
+      sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe->fd = req->fd;
+      sqe->addr = (uintptr_t)&req->vec;
+      sqe->len = 1;
+      sqe->off = req->pos;
+      sqe->user_data = (uintptr_t)req;
+      sqArray[idx] = idx;
+
+      req->prev = nullptr;
+      req->next = inFlight;
+      if (inFlight)
+         inFlight->prev = req;
+      inFlight = req;
+
+      StoreRelease(sqTail, tail + 1);
+      accepted = true;
+
+      if (!onReaper)
+         Flush();
+   exit:
+      return accepted;
+   }
+};
+
+thread_local bool IoUring::onReaper;
+
+#endif
+
+struct AsyncIoEngine
+{
+   lazy_init_state init;
+   ThreadPool *pool;
+#if defined(HAVE_IO_URING)
+   IoUring *ring;
+#endif
+} engine;
+
+void
+InitEngine(void *context, error *err)
+{
+#if defined(HAVE_IO_URING)
+   IoUring *ring = nullptr;
+#endif
+
+   // The pool's threads spend their time blocked in the kernel, so give
+   // it more of them than there are CPUs.
+   //
+   try
+   {
+      engine.pool = new ThreadPool(4 * get_cpu_count());
+   }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+#if defined(HAVE_IO_URING)
+   // The ring goes last: once its reaper is running it cannot be torn
+   // down, so nothing may fail after it.
+   //
+   ring = new (std::nothrow) IoUring();
+   if (!ring)
+      ERROR_SET(err, nomem);
+   if (ring->Initialize(err))
+   {
+      engine.ring = ring;
+      ring = nullptr;
+   }
+   ERROR_CHECK(err);
+#endif
+
+exit:
+   if (ERROR_FAILED(err))
+   {
+      // lazy_init() will call us again next time.
+      //
+      delete engine.pool;
+      engine.pool = nullptr;
+   }
+#if defined(HAVE_IO_URING)
+   delete ring;
+#endif
+}
+
+} // end namespace
+
+void
+common::internal::SubmitAsyncIo(AsyncIoRequest *req, error *err)
+{
+   lazy_init(&engine.init, InitEngine, nullptr, err);
+   ERROR_CHECK(err);
+
+#if defined(HAVE_IO_URING)
+   // If the ring is backed up, the pool takes the overflow.
+   //
+   if (engine.ring && req->fd >= 0 && engine.ring->Submit(req))
+   {
+      req = nullptr;
+      goto exit;
+   }
+#endif
+
+   engine.pool->Schedule(
+      [req] (error *) -> void
+      {
+         RunBlocking(req);
+         req->Complete();
+      },
+      err
+   );
+   ERROR_CHECK(err);
+   req = nullptr;
+
+exit:
+   delete req;
+}
@@ -0,0 +1,70 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef common_src_asyncio_h_
+#define common_src_asyncio_h_
+
+#include <common/c++/stream.h>
+#include <common/c++/scheduler.h>
+
+namespace common {
+namespace internal {
+
+//
+// One read or write handed to the asynchronous I/O engine.
+//
+// The engine issues it against fd natively where it can.  Otherwise it
+// calls stream->Read() or stream->Write() on a pool thread.
+//
+struct AsyncIoRequest
+{
+   Pointer<PStream> stream;
+   int fd;
+   bool write;
+   void *buf;
+   size_t len;
+   uint64_t pos;
+   Scheduler *scheduler;
+   IoCompletion callback;
+
+   size_t result;
+   error err;
+
+   // Scratch space for engines that want an iovec.
+   //
+   IoVec vec;
+
+   // Links for engines that keep a list of requests in flight.
+   //
+   AsyncIoRequest *prev, *next;
+
+   AsyncIoRequest()
+      : fd(-1), write(false), buf(nullptr), len(0), pos(0),
+        scheduler(nullptr), result(0), prev(nullptr), next(nullptr)
+   {
+   }
+
+   AsyncIoRequest(const AsyncIoRequest &) = delete;
+
+   // Runs the callback on the scheduler, or right here if there is none
+   // or it fails, then frees the request.
+   //
+   void
+   Complete(void);
+};
+
+// Takes ownership of req.  On failure it is freed and the callback is
+// never called.
+//
+void
+SubmitAsyncIo(AsyncIoRequest *req, error *err);
+
+} // end namespace
+} // end namespace
+
+#endif
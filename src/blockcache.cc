@@ -0,0 +1,628 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/c++/stream.h>
+#include <common/c++/lock.h>
+#include <common/c++/new.h>
+#include <common/lazy.h>
+#include <common/misc.h>
+#include <common/mutex.h>
+#include <common/waiter.h>
+
+#include <atomic>
+#include <new>
+#include <unordered_map>
+#include <string.h>
+
+namespace {
+
+enum
+{
+   BlockSize = 64 * 1024,
+   Shards = 16,
+};
+
+const size_t DefaultCapacity = 64 * 1024 * 1024;
+
+struct BlockKey
+{
+   uint64_t DeviceId;
+   uint64_t FileId;
+
+   // From StreamInfo::FileGeneration, so that blocks of a file that has
+   // since been replaced, possibly under a reused id, are never found.
+   //
+   uint64_t Generation;
+   uint64_t Block;
+
+   bool
+   operator==(const BlockKey &other) const
+   {
+      return DeviceId == other.DeviceId &&
+             FileId == other.FileId &&
+             Generation == other.Generation &&
+             Block == other.Block;
+   }
+};
+
+struct BlockKeyHash
+{
+   size_t
+   operator()(const BlockKey &key) const
+   {
+      uint64_t h = key.FileId * 0x9e3779b97f4a7c15ULL;
+      h ^= key.DeviceId + (h << 6) + (h >> 2);
+      h ^= key.Generation + (h << 6) + (h >> 2);
+      h ^= key.Block * 0xff51afd7ed558ccdULL;
+      return (size_t)(h ^ (h >> 32));
+   }
+};
+
+//
+// One BlockSize piece of a file.  While the first reader to miss is
+// filling it, anyone else who wants it waits on waiters rather than
+// reading it again.
+//
+struct Block : public common::RefCountable
+{
+   BlockKey key;
+   char *data;
+   size_t len;
+   bool ready;
+
+   // Set if the block was dropped from the cache while being filled, so
+   // that the data might already be out of date.
+   //
+   bool stale;
+
+   waiter_node_queue waiters;
+
+   // LRU list, most recently used first.  Only ready blocks are on it.
+   //
+   Block *prev, *next;
+
+   Block() : data(nullptr), len(0), ready(false), stale(false),
+             waiters(nullptr), prev(nullptr), next(nullptr)
+   {
+      memset(&key, 0, sizeof(key));
+   }
+
+   ~Block() { delete [] data; }
+};
+
+struct Shard
+{
+   mutex lock;
+   std::unordered_map<BlockKey, common::Pointer<Block>, BlockKeyHash> blocks;
+   Block lru;
+   size_t bytes;
+
+   Shard() : bytes(0)
+   {
+      memset(&lock, 0, sizeof(lock));
+      lru.prev = lru.next = &lru;
+   }
+
+   ~Shard() { mutex_destroy(&lock); }
+
+   void
+   Unlink(Block *b)
+   {
+      if (b->prev)
+      {
+         b->prev->next = b->next;
+         b->next->prev = b->prev;
+         b->prev = b->next = nullptr;
+         bytes -= BlockSize;
+      }
+   }
+
+   void
+   PushFront(Block *b)
+   {
+      b->next = lru.next;
+      b->prev = &lru;
+      lru.next->prev = b;
+      lru.next = b;
+      bytes += BlockSize;
+   }
+
+   // Takes b out of the map.  Readers holding a reference keep it alive
+   // until they are done.
+   //
+   void
+   Remove(Block *b)
+   {
+      auto it = blocks.find(b->key);
+
+      Unlink(b);
+      if (!b->ready)
+         b->stale = true;
+      if (it != blocks.end() && it->second.Get() == b)
+         blocks.erase(it);
+   }
+};
+
+struct BlockCache
+{
+   Shard shards[Shards];
+   std::atomic<size_t> capacity;
+   std::atomic<uint64_t> hits, misses, evictions;
+
+   // Identities for streams whose StreamInfo does not give us one.
+   //
+   std::atomic<uint64_t> nextAnonymousId;
+
+   BlockCache()
+      : capacity(DefaultCapacity),
+        hits(0), misses(0), evictions(0),
+        nextAnonymousId(0)
+   {
+   }
+
+   Shard &
+   ShardFor(const BlockKey &key)
+   {
+      return shards[BlockKeyHash()(key) % Shards];
+   }
+
+   // Called with the shard locked.
+   //
+   void
+   Evict(Shard &shard)
+   {
+      size_t limit = capacity.load(std::memory_order_relaxed) / Shards;
+
+      while (shard.bytes > limit && shard.lru.prev != &shard.lru)
+      {
+         shard.Remove(shard.lru.prev);
+         ++evictions;
+      }
+   }
+
+   // Drops every block of the file at or past firstBlock, of any
+   // generation.
+   //
+   void
+   DropFile(uint64_t deviceId, uint64_t fileId, uint64_t firstBlock)
+   {
+      for (auto &shard : shards)
+      {
+         common::locker l;
+         l.acquire(shard.lock);
+
+         for (auto it = shard.blocks.begin(); it != shard.blocks.end(); )
+         {
+            auto b = it->second.Get();
+            ++it;
+            if (b->key.DeviceId == deviceId &&
+                b->key.FileId == fileId &&
+                b->key.Block >= firstBlock)
+            {
+               shard.Remove(b);
+            }
+         }
+      }
+   }
+
+   void
+   DropBlock(const BlockKey &key)
+   {
+      auto &shard = ShardFor(key);
+      common::locker l;
+
+      l.acquire(shard.lock);
+      auto it = shard.blocks.find(key);
+      if (it != shard.blocks.end())
+         shard.Remove(it->second.Get());
+   }
+
+   // Reads one block of the file.  A block shorter than BlockSize ends
+   // at what was the end of the file when it was read.
+   //
+   void
+   Fill(Block *b, common::PStream *stream, error *err)
+   {
+      uint64_t pos = b->key.Block * BlockSize;
+
+      b->data = new (std::nothrow) char[BlockSize];
+      if (!b->data)
+         ERROR_SET(err, nomem);
+
+      while (b->len < BlockSize)
+      {
+         size_t r = stream->Read(b->data + b->len, BlockSize - b->len, pos + b->len, err);
+         ERROR_CHECK(err);
+         if (!r)
+            break;
+         b->len += r;
+      }
+   exit:;
+   }
+
+   void
+   GetBlock(
+      const BlockKey &key,
+      common::PStream *stream,
+      common::Pointer<Block> &out,
+      error *err
+   )
+   {
+      auto &shard = ShardFor(key);
+      common::Pointer<Block> b, mine;
+      struct waiter_node *waiters = nullptr;
+
+      for (;;)
+      {
+         common::locker l;
+         struct waiter_node self;
+
+         l.acquire(shard.lock);
+
+         auto it = shard.blocks.find(key);
+         if (it == shard.blocks.end())
+         {
+            // Allocate outside the lock, then look again: the block must
+            // go into the map in the same hold as the lookup that missed,
+            // or two threads could both decide to read it.
+            //
+            if (!mine.Get())
+            {
+               l.release();
+               common::New(mine.GetAddressOf(), err);
+               ERROR_CHECK(err);
+               mine->key = key;
+               continue;
+            }
+
+            try
+            {
+               shard.blocks.emplace(key, mine);
+            }
+            catch (const std::bad_alloc&)
+            {
+               ERROR_SET(err, nomem);
+            }
+            b = std::move(mine);
+            break;
+         }
+
+         b = it->second;
+         if (b->ready)
+         {
+            shard.Unlink(b.Get());
+            shard.PushFront(b.Get());
+            ++hits;
+            goto exit;
+         }
+
+         // Someone else is reading it.  If they fail, the block is gone
+         // from the map when we look again, and we try ourselves.
+         //
+         waiter_node_init(&self);
+         waiter_node_queue_insert(&b->waiters, &self);
+         l.release();
+         b = nullptr;
+
+         waiter_node_wait(&self);
+         waiter_node_destroy(&self);
+      }
+
+      ++misses;
+
+      Fill(b.Get(), stream, err);
+
+      {
+         common::locker l;
+         l.acquire(shard.lock);
+
+         if (ERROR_FAILED(err))
+         {
+            // If it was dropped while we read, the key may already belong
+            // to someone else's block.
+            //
+            auto it = shard.blocks.find(key);
+            if (it != shard.blocks.end() && it->second.Get() == b.Get())
+               shard.blocks.erase(it);
+         }
+         else if (!b->stale)
+         {
+            b->ready = true;
+            shard.PushFront(b.Get());
+            Evict(shard);
+         }
+
+         waiters = waiter_node_queue_chomp_all(&b->waiters);
+      }
+
+      while (waiters)
+      {
+         struct waiter_node *next = waiters->next;
+         waiter_node_signal(waiters);
+         waiters = next;
+      }
+
+   exit:
+      if (ERROR_FAILED(err))
+         b = nullptr;
+      out = std::move(b);
+   }
+} *cache;
+
+lazy_init_state cacheInit;
+
+BlockCache *
+GetCache(error *err)
+{
+   lazy_init(
+      &cacheInit,
+      [] (void *context, error *err) -> void
+      {
+         BlockCache *p = nullptr;
+
+         try
+         {
+            p = new BlockCache();
+         }
+         catch (const std::bad_alloc&)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         for (auto &shard : p->shards)
+         {
+            mutex_init(&shard.lock, err);
+            ERROR_CHECK(err);
+         }
+
+         // Like the scheduler's thread pools, the cache lives until the
+         // process exits.
+         //
+         cache = p;
+         p = nullptr;
+      exit:
+         delete p;
+      },
+      nullptr,
+      err
+   );
+   return ERROR_FAILED(err) ? nullptr : cache;
+}
+
+struct CachedPStream : public common::PStream
+{
+   common::Pointer<common::PStream> stream;
+   BlockCache *cache;
+   uint64_t deviceId;
+   uint64_t fileId;
+   uint64_t generation;
+   bool anonymous;
+
+   CachedPStream()
+      : cache(nullptr), deviceId(0), fileId(0), generation(0), anonymous(false)
+   {
+   }
+
+   ~CachedPStream()
+   {
+      // Nobody else can find these blocks again.
+      //
+      if (cache && anonymous)
+         cache->DropFile(deviceId, fileId, 0);
+   }
+
+   void
+   Initialize(common::PStream *stream, error *err)
+   {
+      common::StreamInfo info;
+
+      this->stream = stream;
+
+      cache = GetCache(err);
+      ERROR_CHECK(err);
+
+      stream->GetStreamInfo(&info, err);
+      ERROR_CHECK(err);
+
+      if (info.FileIdKnown)
+      {
+         deviceId = info.DeviceId;
+         fileId = info.FileId;
+         generation = info.FileGeneration;
+      }
+      else
+      {
+         anonymous = true;
+         deviceId = ~(uint64_t)0;
+         fileId = cache->nextAnonymousId++;
+      }
+   exit:;
+   }
+
+   BlockKey
+   KeyFor(uint64_t block)
+   {
+      BlockKey key = {deviceId, fileId, generation, block};
+      return key;
+   }
+
+   size_t
+   Read(void *buf, size_t len, uint64_t pos, error *err)
+   {
+      size_t r = 0;
+
+      while (len)
+      {
+         common::Pointer<Block> b;
+         size_t off = pos % BlockSize;
+         size_t n = 0;
+
+         cache->GetBlock(KeyFor(pos / BlockSize), stream.Get(), b, err);
+         ERROR_CHECK(err);
+
+         if (off < b->len)
+         {
+            n = MIN(len, b->len - off);
+            memcpy(buf, b->data + off, n);
+            buf = (char*)buf + n;
+            len -= n;
+            pos += n;
+            r += n;
+         }
+
+         // A short block was the end of the file when we read it, but
+         // the file may have grown since.  Anything past it comes
+         // straight from the file.
+         //
+         if (len && b->len < BlockSize)
+         {
+            r += stream->Read(buf, len, pos, err);
+            ERROR_CHECK(err);
+            break;
+         }
+      }
+   exit:
+      return r;
+   }
+
+   // A view inside one block holds a reference to it.
+   //
+   void
+   AcquireView(uint64_t pos, size_t len, View *view, error *err)
+   {
+      common::Pointer<Block> b;
+      size_t off = pos % BlockSize;
+
+      *view = View();
+
+      if (off + len <= BlockSize)
+      {
+         cache->GetBlock(KeyFor(pos / BlockSize), stream.Get(), b, err);
+         ERROR_CHECK(err);
+
+         if (off + len <= b->len || b->len == BlockSize)
+         {
+            view->Data = b->data + off;
+            view->Length = off < b->len ? MIN(len, b->len - off) : 0;
+            view->Context = b.Detach();
+            view->Release = [] (void *context) -> void
+            {
+               ((Block*)context)->Release();
+            };
+            goto exit;
+         }
+      }
+
+      PStream::AcquireView(pos, len, view, err);
+   exit:;
+   }
+
+   void
+   Invalidate(uint64_t pos, size_t len)
+   {
+      if (!len)
+         return;
+
+      for (uint64_t i = pos / BlockSize; i <= (pos + len - 1) / BlockSize; ++i)
+         cache->DropBlock(KeyFor(i));
+   }
+
+   // Writes go straight through to the file.
+   //
+   size_t
+   Write(const void *buf, size_t len, uint64_t pos, error *err)
+   {
+      size_t r = stream->Write(buf, len, pos, err);
+      Invalidate(pos, len);
+      return r;
+   }
+
+   size_t
+   WriteV(const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      size_t len = 0;
+      size_t r = stream->WriteV(vec, count, pos, err);
+
+      for (int i=0; i<count; ++i)
+         len += vec[i].Length;
+      Invalidate(pos, len);
+      return r;
+   }
+
+   void
+   Truncate(uint64_t length, error *err)
+   {
+      stream->Truncate(length, err);
+      cache->DropFile(deviceId, fileId, length / BlockSize);
+   }
+
+   uint64_t GetSize(error *err) { return stream->GetSize(err); }
+   void Flush(error *err) { stream->Flush(err); }
+   void GetStreamInfo(common::StreamInfo *info, error *err) { stream->GetStreamInfo(info, err); }
+};
+
+} // end namespace
+
+void
+common::CreateCachedStream(PStream *stream, PStream **out, error *err)
+{
+   common::Pointer<CachedPStream> r;
+
+   New(r.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   r->Initialize(stream, err);
+   ERROR_CHECK(err);
+
+exit:
+   if (ERROR_FAILED(err))
+      r = nullptr;
+   *out = r.Detach();
+}
+
+void
+common::SetBlockCacheCapacity(size_t bytes)
+{
+   error err;
+   auto cache = GetCache(&err);
+
+   if (cache)
+   {
+      cache->capacity = bytes;
+      for (auto &shard : cache->shards)
+      {
+         common::locker l;
+         l.acquire(shard.lock);
+         cache->Evict(shard);
+      }
+   }
+}
+
+void
+common::GetBlockCacheStats(BlockCacheStats *stats)
+{
+   error err;
+   auto cache = GetCache(&err);
+
+   memset(stats, 0, sizeof(*stats));
+
+   if (cache)
+   {
+      stats->Hits = cache->hits;
+      stats->Misses = cache->misses;
+      stats->Evictions = cache->evictions;
+
+      for (auto &shard : cache->shards)
+      {
+         common::locker l;
+         l.acquire(shard.lock);
+         stats->BytesCached += shard.bytes;
+         stats->Blocks += shard.blocks.size();
+      }
+   }
+}
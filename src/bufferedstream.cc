@@ -0,0 +1,400 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/c++/stream.h>
+#include <common/c++/new.h>
+#include <common/misc.h>
+
+#include <new>
+#include <string.h>
+
+namespace {
+
+//
+// The buffer holds either data read ahead of the caller, or data written
+// by the caller and not yet passed on, never both.  Either way it covers
+// the range [bufStart, bufStart + bufLen) of the file.
+//
+// The underlying stream is only seeked when we next need to touch it,
+// and then only if it is not already where we want it.  Pipes and
+// sockets have no position; for those we count from 0 and never seek
+// unless the caller does.
+//
+struct BufferedStream : public common::Stream
+{
+   common::Pointer<common::Stream> stream;
+   char *buffer;
+   size_t bufferSize;
+   uint64_t bufStart;
+   size_t bufLen;
+   bool dirty;
+   bool seekable;
+
+   // Our logical position, and where the underlying stream is.
+   //
+   uint64_t pos;
+   uint64_t basePos;
+
+   BufferedStream()
+      : buffer(nullptr),
+        bufferSize(0),
+        bufStart(0),
+        bufLen(0),
+        dirty(false),
+        seekable(true),
+        pos(0),
+        basePos(0)
+   {
+   }
+
+   ~BufferedStream()
+   {
+      error err;
+      FlushBuffer(&err);
+      delete [] buffer;
+   }
+
+   void
+   Initialize(common::Stream *stream, size_t bufferSize, error *err)
+   {
+      this->stream = stream;
+      this->bufferSize = bufferSize ? bufferSize : 1;
+
+      buffer = new (std::nothrow) char[this->bufferSize];
+      if (!buffer)
+         ERROR_SET(err, nomem);
+
+      pos = basePos = stream->GetPosition(err);
+      if (ERROR_FAILED(err))
+      {
+         error_clear(err);
+         pos = basePos = 0;
+         seekable = false;
+      }
+      bufStart = pos;
+   exit:;
+   }
+
+   void
+   SyncPosition(uint64_t target, error *err)
+   {
+      // A pipe or socket has no position to go back to; reads and writes
+      // just carry on from wherever it is.
+      //
+      if (basePos != target && seekable)
+      {
+         stream->Seek(target, SEEK_SET, err);
+         ERROR_CHECK(err);
+         basePos = target;
+      }
+   exit:;
+   }
+
+   // Drops any read-ahead, and starts the buffer over at pos.
+   //
+   void
+   DropBuffer(void)
+   {
+      if (!dirty)
+      {
+         bufStart = pos;
+         bufLen = 0;
+      }
+   }
+
+   void
+   WriteAll(const void *buf, size_t len, error *err)
+   {
+      while (len)
+      {
+         size_t r = stream->Write(buf, len, err);
+         ERROR_CHECK(err);
+         if (!r)
+            ERROR_SET(err, unknown, "Short write");
+         buf = (const char*)buf + r;
+         len -= r;
+         basePos += r;
+      }
+   exit:;
+   }
+
+   // Passes on any buffered writes.
+   //
+   void
+   FlushBuffer(error *err)
+   {
+      if (!dirty)
+         return;
+
+      if (bufLen)
+      {
+         uint64_t before = 0;
+
+         SyncPosition(bufStart, err);
+         ERROR_CHECK(err);
+
+         before = basePos;
+         WriteAll(buffer, bufLen, err);
+         if (ERROR_FAILED(err))
+         {
+            // Keep whatever did not make it out.
+            //
+            size_t n = basePos - before;
+            memmove(buffer, buffer + n, bufLen - n);
+            bufStart += n;
+            bufLen -= n;
+            goto exit;
+         }
+      }
+      dirty = false;
+      bufStart = pos;
+      bufLen = 0;
+   exit:;
+   }
+
+   uint64_t
+   GetSize(error *err)
+   {
+      FlushBuffer(err);
+      if (ERROR_FAILED(err))
+         return 0;
+      return stream->GetSize(err);
+   }
+
+   uint64_t GetPosition(error *err) { return pos; }
+
+   void
+   Flush(error *err)
+   {
+      FlushBuffer(err);
+      ERROR_CHECK(err);
+      stream->Flush(err);
+   exit:;
+   }
+
+   void
+   Seek(int64_t off, int whence, error *err)
+   {
+      switch (whence)
+      {
+      case SEEK_CUR:
+         off += pos;
+         whence = SEEK_SET;
+         // fall through ...
+      case SEEK_SET:
+         // Moving around inside what we have read ahead is free.
+         //
+         if (!dirty && off >= 0 &&
+             (uint64_t)off >= bufStart && (uint64_t)off <= bufStart + bufLen)
+         {
+            pos = off;
+            goto exit;
+         }
+         break;
+      }
+
+      FlushBuffer(err);
+      ERROR_CHECK(err);
+
+      stream->Seek(off, whence, err);
+      ERROR_CHECK(err);
+      pos = basePos = stream->GetPosition(err);
+      ERROR_CHECK(err);
+      bufStart = pos;
+      bufLen = 0;
+   exit:;
+   }
+
+   // Refills the buffer from pos.
+   //
+   void
+   Fill(error *err)
+   {
+      size_t r = 0;
+
+      bufStart = pos;
+      bufLen = 0;
+
+      SyncPosition(pos, err);
+      ERROR_CHECK(err);
+
+      r = stream->Read(buffer, bufferSize, err);
+      ERROR_CHECK(err);
+      basePos += r;
+      bufLen = r;
+   exit:;
+   }
+
+   // Reads from the buffer, and goes to the underlying stream at most
+   // once, so that a short read from a pipe or socket does not block on
+   // the next one.
+   //
+   size_t
+   Read(void *buf, size_t len, error *err)
+   {
+      size_t r = 0;
+      bool wentToStream = false;
+
+      FlushBuffer(err);
+      ERROR_CHECK(err);
+
+      while (len)
+      {
+         if (pos >= bufStart && pos < bufStart + bufLen)
+         {
+            size_t n = MIN(len, bufStart + bufLen - pos);
+            memcpy(buf, buffer + (pos - bufStart), n);
+            buf = (char*)buf + n;
+            len -= n;
+            pos += n;
+            r += n;
+         }
+         else if (wentToStream)
+         {
+            break;
+         }
+         else if (len >= bufferSize)
+         {
+            // Too big to be worth copying through the buffer.
+            //
+            size_t n = 0;
+
+            wentToStream = true;
+            DropBuffer();
+            SyncPosition(pos, err);
+            ERROR_CHECK(err);
+            n = stream->Read(buf, len, err);
+            ERROR_CHECK(err);
+            basePos += n;
+            pos += n;
+            r += n;
+            bufStart = pos;
+            break;
+         }
+         else
+         {
+            wentToStream = true;
+            Fill(err);
+            ERROR_CHECK(err);
+            if (!bufLen)
+               break;
+         }
+      }
+   exit:
+      return r;
+   }
+
+   size_t
+   Write(const void *buf, size_t len, error *err)
+   {
+      size_t r = 0;
+
+      // While the buffer is dirty, pos is always at its end, since reads
+      // and seeks flush it first.
+      //
+      if (!dirty)
+      {
+         DropBuffer();
+         dirty = true;
+      }
+
+      if (bufLen + len > bufferSize)
+      {
+         FlushBuffer(err);
+         ERROR_CHECK(err);
+         dirty = true;
+
+         if (len >= bufferSize)
+         {
+            SyncPosition(pos, err);
+            ERROR_CHECK(err);
+            WriteAll(buf, len, err);
+            ERROR_CHECK(err);
+            pos += len;
+            bufStart = pos;
+            r = len;
+            goto exit;
+         }
+      }
+
+      memcpy(buffer + bufLen, buf, len);
+      bufLen += len;
+      pos += len;
+      r = len;
+   exit:
+      return r;
+   }
+
+   void
+   Truncate(uint64_t length, error *err)
+   {
+      FlushBuffer(err);
+      ERROR_CHECK(err);
+      DropBuffer();
+      stream->Truncate(length, err);
+   exit:;
+   }
+
+   void
+   GetStreamInfo(common::StreamInfo *info, error *err)
+   {
+      stream->GetStreamInfo(info, err);
+   }
+
+   void
+   ToPStream(common::PStream **out, error *err)
+   {
+      FlushBuffer(err);
+      ERROR_CHECK(err);
+      stream->ToPStream(out, err);
+   exit:;
+   }
+};
+
+} // end namespace
+
+void
+common::CreateBufferedStream(
+   Stream *stream,
+   size_t bufferSize,
+   Stream **out,
+   error *err
+)
+{
+   common::Pointer<BufferedStream> r;
+
+   New(r.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   r->Initialize(stream, bufferSize, err);
+   ERROR_CHECK(err);
+
+exit:
+   if (ERROR_FAILED(err))
+      r = nullptr;
+   *out = r.Detach();
+}
+
+void
+common::CreateBufferedStream(
+   PStream *stream,
+   size_t bufferSize,
+   Stream **out,
+   error *err
+)
+{
+   common::Pointer<Stream> wrapped;
+
+   stream->ToStream(wrapped.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   CreateBufferedStream(wrapped.Get(), bufferSize, out, err);
+   ERROR_CHECK(err);
+
+exit:;
+}
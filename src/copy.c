@@ -20,6 +20,10 @@
 //    Solaris: use sendfile(3C)
 //    Other: read(2) and write(2)
 //
+// copy_fd_range() copies between offsets in two descriptors, so it can
+// only use copy_file_range(2); sendfile(2) and splice(2) write at the
+// file position of the output.  Otherwise it uses pread(2) and pwrite(2).
+//
 
 #include <common/path.h>
 #include <common/misc.h>
@@ -28,6 +32,8 @@
 #if defined(_WINDOWS)
 #include <windows.h>
 #else
+#include <errno.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -216,3 +222,114 @@ exit:
       close(outfd);
 }
 #endif
+
+#if !defined(_WINDOWS)
+
+static
+uint64_t
+copy_fd_range_readwrite(
+   int infd,
+   uint64_t inoff,
+   int outfd,
+   uint64_t outoff,
+   uint64_t len,
+   error *err
+)
+{
+   const size_t bufsize = 1024 * 1024;
+   char *buf = NULL;
+   uint64_t total = 0;
+
+   buf = malloc(MIN(len, bufsize));
+   if (len && !buf)
+      ERROR_SET(err, nomem);
+
+   while (len)
+   {
+      ssize_t r = pread(infd, buf, MIN(len, bufsize), inoff);
+      char *dstbuf = buf;
+      size_t n = 0;
+
+      if (r < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         ERROR_SET(err, errno, errno);
+      }
+      if (!r)
+         break;
+
+      n = r;
+      while (n)
+      {
+         r = pwrite(outfd, dstbuf, n, outoff);
+         if (r < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            ERROR_SET(err, errno, errno);
+         }
+         if (!r)
+            ERROR_SET(err, unknown, "Unexpected zero write");
+         dstbuf += r;
+         n -= r;
+         inoff += r;
+         outoff += r;
+         total += r;
+         len -= r;
+      }
+   }
+
+exit:
+   free(buf);
+   return total;
+}
+
+uint64_t
+copy_fd_range(
+   int infd,
+   uint64_t inoff,
+   int outfd,
+   uint64_t outoff,
+   uint64_t len,
+   error *err
+)
+{
+   uint64_t total = 0;
+
+#if defined(__linux__)
+   while (len)
+   {
+      loff_t readOff = inoff, writeOff = outoff;
+      ssize_t r = copy_file_range(infd, &readOff, outfd, &writeOff, MIN(len, SSIZE_MAX), 0);
+
+      if (r < 0)
+      {
+         if (errno == EINTR)
+            continue;
+
+         // Old kernels, copies across filesystems before Linux 5.3, and
+         // files the kernel cannot copy between.
+         //
+         if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+             errno == EOPNOTSUPP)
+            break;
+
+         ERROR_SET(err, errno, errno);
+      }
+      if (!r)
+         goto exit;
+
+      inoff += r;
+      outoff += r;
+      total += r;
+      len -= r;
+   }
+#endif
+
+   total += copy_fd_range_readwrite(infd, inoff, outfd, outoff, len, err);
+exit:
+   return total;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/c++/coroutine.h>
+
+#if defined(COMMON_HAVE_COROUTINES)
+
+#include <new>
+
+namespace {
+
+// Frames are rounded up to a multiple of Granularity; those up to
+// Granularity * Classes bytes are cached, up to MaxCached of each size.
+//
+const size_t Granularity = 64;
+const size_t Classes = 16;
+const int MaxCached = 64;
+
+struct FreeFrame
+{
+   FreeFrame *next;
+};
+
+//
+// The pool has no constructor or destructor, so it is usable for as long
+// as the thread runs, including from other thread_local destructors that
+// free a frame.  Its cached frames are given back by FramePoolDrain, which
+// runs at thread exit once anything has been cached; after that, frames
+// go straight to the heap.
+//
+struct FramePool
+{
+   FreeFrame *lists[Classes];
+   int counts[Classes];
+   bool draining;
+   bool exited;
+};
+
+thread_local FramePool pool;
+
+struct FramePoolDrain
+{
+   ~FramePoolDrain()
+   {
+      pool.exited = true;
+
+      for (size_t i=0; i<Classes; ++i)
+      {
+         auto p = pool.lists[i];
+         while (p)
+         {
+            auto next = p->next;
+            ::operator delete(p);
+            p = next;
+         }
+         pool.lists[i] = nullptr;
+         pool.counts[i] = 0;
+      }
+   }
+};
+
+thread_local FramePoolDrain drain;
+
+size_t
+SizeClass(size_t size)
+{
+   return size ? (size - 1) / Granularity : 0;
+}
+
+} // end namespace
+
+void *
+common::internal::AllocateCoroutineFrame(size_t size)
+{
+   size_t cls = SizeClass(size);
+
+   if (cls >= Classes)
+      return ::operator new(size);
+
+   auto p = pool.lists[cls];
+   if (p)
+   {
+      pool.lists[cls] = p->next;
+      --pool.counts[cls];
+      return p;
+   }
+
+   return ::operator new((cls + 1) * Granularity);
+}
+
+void
+common::internal::FreeCoroutineFrame(void *ptr, size_t size)
+{
+   size_t cls = SizeClass(size);
+
+   if (cls < Classes && pool.counts[cls] < MaxCached && !pool.exited)
+   {
+      auto p = (FreeFrame*)ptr;
+
+      // First use of drain on this thread arranges for its destructor.
+      //
+      if (!pool.draining)
+      {
+         pool.draining = true;
+         (void)&drain;
+      }
+
+      p->next = pool.lists[cls];
+      pool.lists[cls] = p;
+      ++pool.counts[cls];
+      return;
+   }
+
+   ::operator delete(ptr);
+}
+
+#endif
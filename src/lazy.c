@@ -9,13 +9,60 @@
 #include <common/lazy.h>
 #include <common/cas.h>
 #include <common/spin.h>
+#include <common/waiter.h>
 
-enum
+#include <stdint.h>
+
+//
+// The state is one of None, Initialized, or a pointer to the most recent
+// waiter_node tagged with Initializing, forming a stack of threads
+// waiting for the initializer.  A stack with nobody on it is just the
+// tag.
+//
+
+#define None         ((void*)0)
+#define Initialized  ((void*)1)
+#define Initializing ((uintptr_t)2)
+
+#define IS_INITIALIZING(p) ((uintptr_t)(p) & Initializing)
+#define WAITERS(p)         ((struct waiter_node *)((uintptr_t)(p) & ~(uintptr_t)3))
+
+// How many times to check on the initializer before going to sleep.
+//
+#define LAZY_SPIN 100
+
+#if defined(__GNUC__)
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#else
+// MSVC gives volatile reads acquire semantics.
+#define load_acquire(p) (*(p))
+#endif
+
+static void
+lazy_wake(struct waiter_node *node)
 {
-   None = 0,
-   Initializing,
-   Initialized,
-};
+   while (node)
+   {
+      struct waiter_node *next = node->next;
+      waiter_node_signal(node);
+      node = next;
+   }
+}
+
+static void
+lazy_finish(lazy_init_state *state, void *result)
+{
+   void *old;
+
+   // Take the stack of waiters, and wake them.
+   //
+   do
+   {
+      old = load_acquire(&state->state);
+   } while (!compare_and_swap_pointer(&state->state, old, result));
+
+   lazy_wake(WAITERS(old));
+}
 
 void
 lazy_init(
@@ -25,33 +72,71 @@ lazy_init(
   error *err
 )
 {
-  for (;;)
-  {
-     switch (state->state)
-     {
-        case Initialized:
-           return;
-        case None:
-           if (compare_and_swap(&state->state, None, Initializing))
-           {
-              fn(context, err);
-              state->state = (err && ERROR_FAILED(err)) ? None : Initialized;
-              memory_barrier();
-              return;
-           } 
-        case Initializing:
-           spin();
-           continue;
-        default:
-           if (err)
-              error_set_unknown(err, "Unexpected enum value");
-           return;
-     }
-  }
+   struct waiter_node self;
+   bool haveNode = false;
+   int spins = 0;
+
+   for (;;)
+   {
+      void *s = load_acquire(&state->state);
+
+      if (s == Initialized)
+         break;
+
+      if (s == None)
+      {
+         if (compare_and_swap_pointer(&state->state, None, (void*)Initializing))
+         {
+            fn(context, err);
+            lazy_finish(state, (err && ERROR_FAILED(err)) ? None : Initialized);
+            break;
+         }
+         continue;
+      }
+
+      if (!IS_INITIALIZING(s))
+      {
+         if (err)
+            error_set_unknown(err, "Unexpected enum value");
+         break;
+      }
+
+      // Most initializers are quick, so give this one a chance to finish
+      // before paying for a kernel wait.
+      //
+      if (spins < LAZY_SPIN)
+      {
+         ++spins;
+         spin_pause();
+         continue;
+      }
+
+      if (!haveNode)
+      {
+         waiter_node_init(&self);
+         haveNode = true;
+      }
+
+      self.next = WAITERS(s);
+      if (compare_and_swap_pointer(
+             &state->state,
+             s,
+             (void*)((uintptr_t)&self | Initializing)))
+      {
+         // A node is good for one signal.
+         //
+         waiter_node_wait(&self);
+         waiter_node_destroy(&self);
+         haveNode = false;
+      }
+   }
+
+   if (haveNode)
+      waiter_node_destroy(&self);
 }
 
 bool
 lazy_is_initialized(lazy_init_state *state)
 {
-   return state->state == Initialized;
-}
\ No newline at end of file
+   return load_acquire(&state->state) == Initialized;
+}
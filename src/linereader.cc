@@ -8,7 +8,31 @@
 
 #include <common/c++/linereader.h>
 
-common::LineReader::LineReader(common::Stream *str) : stream(str), off(0), inBuf(0) {}
+#include <string.h>
+
+common::LineReader::LineReader(common::Stream *str, size_t bufferSize)
+   : stream(str),
+     bufSize(bufferSize < 2 ? 2 : bufferSize),
+     off(0),
+     inBuf(0)
+{
+   // Two bytes are enough to look past a CR.  One more leaves room to
+   // terminate a line at the end of the buffer.
+   //
+   buf.resize(bufSize + 1);
+}
+
+// Reads more into the free space at the end of the buffer.
+//
+size_t
+common::LineReader::Fill(error *err)
+{
+   size_t r = stream->Read(buf.data() + inBuf, bufSize - inBuf, err);
+   if (ERROR_FAILED(err))
+      return 0;
+   inBuf += r;
+   return r;
+}
 
 int
 common::LineReader::ReadChar(error *err)
@@ -19,63 +43,131 @@ common::LineReader::ReadChar(error *err)
    {
       off = inBuf = 0;
 
-      inBuf = stream->Read(buf, sizeof(buf), err);
+      Fill(err);
       ERROR_CHECK(err);
       if (!inBuf)
          goto exit;
    }
 
-   c = buf[off++];
+   c = (unsigned char)buf[off++];
 exit:
    return c;
 }
 
+static const char *
+FindTerminator(const char *p, size_t n)
+{
+   auto lf = (const char*)memchr(p, '\n', n);
+   auto cr = (const char*)memchr(p, '\r', lf ? lf - p : n);
+   return cr ? cr : lf;
+}
+
 char *
 common::LineReader::ReadLine(error *err)
 {
-   // TODO: if we can find a line terminator within the current buffer,
-   // return it directly.
+   char *r = nullptr;
+   char *base = buf.data();
+
+   // Everything in [off, scan) is known not to hold a terminator.
+   //
+   size_t scan = off;
+   bool eof = false;
 
    lineBuf.resize(0);
 
    for (;;)
    {
-      int c = ReadChar(err);
-      ERROR_CHECK(err);
+      auto p = FindTerminator(base + scan, inBuf - scan);
+      size_t end = p ? p - base : inBuf;
 
-      switch (c)
+      // A CR at the end of the buffer might be half of a CRLF, so unless
+      // the stream is done, we need the next byte first.
+      //
+      if (p && (*p == '\n' || end + 1 < inBuf || eof))
       {
-      case EOF:
-         if (!lineBuf.size())
+         size_t next = end + 1;
+
+         if (*p == '\r' && next < inBuf && base[next] == '\n')
+            ++next;
+
+         base[end] = 0;
+         r = base + off;
+
+         if (lineBuf.size())
+         {
+            try
+            {
+               lineBuf.insert(lineBuf.end(), base + off, base + end + 1);
+            }
+            catch (const std::bad_alloc&)
+            {
+               ERROR_SET(err, nomem);
+            }
+            r = lineBuf.data();
+         }
+
+         off = next;
+         goto exit;
+      }
+
+      if (eof)
+      {
+         if (off == inBuf && !lineBuf.size())
             goto exit;
-         c = 0;
-         break;
-      case '\r':
-         // Try to convert CRLF to LF.
-         c = ReadChar(err);
-         ERROR_CHECK(err);
-         // Put back any non-'\n' char
-         if (c != EOF && c != '\n')
-            off--;
-         // fall through
-      case '\n':
-         c = 0;
-         break;
+
+         base[inBuf] = 0;
+         r = base + off;
+
+         if (lineBuf.size())
+         {
+            try
+            {
+               lineBuf.insert(lineBuf.end(), base + off, base + inBuf + 1);
+            }
+            catch (const std::bad_alloc&)
+            {
+               ERROR_SET(err, nomem);
+            }
+            r = lineBuf.data();
+         }
+
+         off = inBuf;
+         goto exit;
       }
 
-      try
+      // Make room to read more.  Move the partial line to the front of
+      // the buffer, or if it fills the buffer already, set it aside.
+      //
+      if (off)
       {
-         lineBuf.push_back(c);
+         memmove(base, base + off, inBuf - off);
+         inBuf -= off;
+         end -= off;
+         off = 0;
       }
-      catch (const std::bad_alloc&)
+      else if (inBuf == bufSize)
       {
-         ERROR_SET(err, nomem);
+         try
+         {
+            lineBuf.insert(lineBuf.end(), base, base + end);
+         }
+         catch (const std::bad_alloc&)
+         {
+            ERROR_SET(err, nomem);
+         }
+         memmove(base, base + end, inBuf - end);
+         inBuf -= end;
+         end = 0;
+      }
+      scan = end;
+
+      if (!Fill(err))
+      {
+         ERROR_CHECK(err);
+         eof = true;
       }
-      if (c == 0)
-         break;
    }
 
-   return (char*)lineBuf.data();
 exit:
-   return nullptr;
-}
\ No newline at end of file
+   return r;
+}
@@ -11,7 +11,9 @@
 #include <common/c++/lock.h>
 #include <common/cas.h>
 #include <common/misc.h>
+#include <common/rwlock.h>
 
+#include <atomic>
 #include <vector>
 
 void *
@@ -33,7 +35,18 @@ common::MemoryStreamBuffer::Resize(size_t sz, error *err)
 exit:;
 }
 
-common::MemoryStreamBuffer::MemoryStreamBuffer() : Writeable(false) {}
+void *
+common::MemoryStreamBuffer::GetSegment(size_t pos, size_t &len)
+{
+   len = GetSize() - pos;
+   return (char*)GetBuffer() + pos;
+}
+
+common::MemoryStreamBuffer::MemoryStreamBuffer()
+   : Writeable(false), StableAddresses(false)
+{
+}
+
 common::MemoryStreamBuffer::~MemoryStreamBuffer() {}
 
 namespace
@@ -78,12 +91,144 @@ struct MemoryStreamBufferVector : public common::MemoryStreamBuffer
    }
 };
 
+//
+// A buffer made of equal power-of-two sized chunks.  Growing it allocates
+// more chunks and never moves the ones already there.  Chunks are only
+// freed with the buffer.
+//
+// The directory of chunks is replaced when it fills up, but old ones are
+// kept until the buffer is freed, so that a reader looking at one while a
+// writer grows the buffer is safe.  Their total size is less than twice
+// that of the newest one.
+//
+struct MemoryStreamBufferChunked : public common::MemoryStreamBuffer
+{
+   struct Directory
+   {
+      Directory *prev;
+      size_t capacity;
+      char **chunks;
+
+      Directory() : prev(nullptr), capacity(0), chunks(nullptr) {}
+      ~Directory() { delete [] chunks; }
+   };
+
+   int chunkShift;
+   size_t chunkSize;
+   std::atomic<Directory*> dir;
+   size_t nChunks;
+   std::atomic<size_t> size;
+
+   MemoryStreamBufferChunked()
+      : chunkShift(0), chunkSize(0), dir(nullptr), nChunks(0), size(0)
+   {
+      Writeable = true;
+      StableAddresses = true;
+   }
+
+   ~MemoryStreamBufferChunked()
+   {
+      Directory *d = dir.load(std::memory_order_relaxed);
+
+      if (d)
+      {
+         for (size_t i=0; i<nChunks; ++i)
+            delete [] d->chunks[i];
+      }
+
+      while (d)
+      {
+         auto prev = d->prev;
+         delete d;
+         d = prev;
+      }
+   }
+
+   void
+   SetChunkSize(size_t chunkSize)
+   {
+      chunkShift = 12;
+      while (((size_t)1 << chunkShift) < chunkSize)
+         ++chunkShift;
+      this->chunkSize = (size_t)1 << chunkShift;
+   }
+
+   void *GetBuffer() { return nullptr; }
+   size_t GetSize()  { return size.load(std::memory_order_relaxed); }
+
+   void *
+   GetSegment(size_t pos, size_t &len)
+   {
+      Directory *d = dir.load(std::memory_order_acquire);
+      size_t off = pos & (chunkSize - 1);
+
+      len = MIN(chunkSize - off, GetSize() - pos);
+      return d->chunks[pos >> chunkShift] + off;
+   }
+
+   void
+   Resize(size_t len, error *err)
+   {
+      size_t needed = (len + chunkSize - 1) >> chunkShift;
+      size_t oldSize = GetSize();
+      Directory *d = dir.load(std::memory_order_relaxed);
+
+      if (needed > (d ? d->capacity : 0))
+      {
+         Directory *nd = new (std::nothrow) Directory();
+         if (!nd)
+            ERROR_SET(err, nomem);
+
+         nd->capacity = MAX(needed, d ? 2 * d->capacity : 16);
+         nd->chunks = new (std::nothrow) char*[nd->capacity];
+         if (!nd->chunks)
+         {
+            delete nd;
+            ERROR_SET(err, nomem);
+         }
+
+         for (size_t i=0; i<nChunks; ++i)
+            nd->chunks[i] = d->chunks[i];
+
+         nd->prev = d;
+         dir.store(nd, std::memory_order_release);
+         d = nd;
+      }
+
+      // Chunks we kept after shrinking may still hold old data.  New ones
+      // start out zeroed.
+      //
+      for (size_t pos = oldSize; pos < MIN(len, nChunks << chunkShift); )
+      {
+         size_t off = pos & (chunkSize - 1);
+         size_t n = MIN(chunkSize - off, len - pos);
+         memset(d->chunks[pos >> chunkShift] + off, 0, n);
+         pos += n;
+      }
+
+      while (nChunks < needed)
+      {
+         char *chunk = new (std::nothrow) char[chunkSize]();
+         if (!chunk)
+            ERROR_SET(err, nomem);
+         d->chunks[nChunks++] = chunk;
+      }
+
+      size.store(len, std::memory_order_release);
+   exit:;
+   }
+};
+
 struct MemoryStream : public common::PStream
 {
    common::MemoryStreamBuffer *mem;
    size_t len;
    common::MemoryStreamLockSheme locking;
-   mutex resizeLock;    // TODO: switch to rwlock
+
+   // Readers share this; it is only held exclusively while the buffer is
+   // being resized, and so might move.
+   //
+   rwlock resizeLock;
    mutex writeLock;
 
    MemoryStream() : mem(nullptr), len(0), locking(common::NoSynchronization) {}
@@ -100,27 +245,40 @@ struct MemoryStream : public common::PStream
          mutex_destroy(&writeLock);
          // fall through
       case common::SingleWriter:
-         mutex_destroy(&resizeLock);
+         rwlock_destroy(&resizeLock);
       }
    }
 
    void
    SynchronizeForRead(common::locker &l)
    {
+      if (mem->StableAddresses)
+         return;
+
       switch (locking)
       {
       case common::NoSynchronization:
          break;
       case common::SingleWriter:
       case common::MultipleWriter:
-         l.acquire(resizeLock);
+         l.acquire_shared(resizeLock);
       }
    }
 
    void
    SynchronizeForResize(common::locker &l)
    {
-      SynchronizeForRead(l);
+      if (mem->StableAddresses)
+         return;
+
+      switch (locking)
+      {
+      case common::NoSynchronization:
+         break;
+      case common::SingleWriter:
+      case common::MultipleWriter:
+         l.acquire(resizeLock);
+      }
    }
 
    void
@@ -144,8 +302,7 @@ struct MemoryStream : public common::PStream
       error *err
    )
    {
-      mutex *mutices[2];
-      int mi = 0;
+      bool haveWriteLock = false;
 
       len = buf ? buf->GetSize() : 0;
       mem = buf;
@@ -158,16 +315,15 @@ struct MemoryStream : public common::PStream
       case common::MultipleWriter:
          mutex_init(&writeLock, err);
          ERROR_CHECK(err);
-         mutices[mi++] = &writeLock;
+         haveWriteLock = true;
          // fall through
       case common::SingleWriter:
-         mutex_init(&resizeLock, err);
+         rwlock_init(&resizeLock, err);
          ERROR_CHECK(err);
-         mutices[mi++] = &resizeLock;
       }
 
       this->locking = locking;
-      mi = 0;
+      haveWriteLock = false;
 
       if (!mem)
       {
@@ -175,10 +331,23 @@ struct MemoryStream : public common::PStream
          ERROR_CHECK(err);
       }
    exit:
-      if (ERROR_FAILED(err))
+      if (ERROR_FAILED(err) && haveWriteLock)
+         mutex_destroy(&writeLock);
+   }
+
+   template<typename Fn>
+   void
+   ForEachSegment(uint64_t pos, size_t len, Fn fn)
+   {
+      while (len)
       {
-         for (int i=mi-1; i >= 0; --i)
-            mutex_destroy(mutices[i]);
+         size_t n = 0;
+         char *p = (char*)mem->GetSegment(pos, n);
+
+         n = MIN(n, len);
+         fn(p, n);
+         pos += n;
+         len -= n;
       }
    }
 
@@ -214,7 +383,11 @@ struct MemoryStream : public common::PStream
       else if (length > this->len)
       {
       clearDelta:
-         memset((char*)mem->GetBuffer() + this->len, 0, length - this->len);
+         ForEachSegment(
+            this->len,
+            length - this->len,
+            [] (char *p, size_t n) -> void { memset(p, 0, n); }
+         );
          memory_barrier();
       }
 
@@ -235,14 +408,90 @@ struct MemoryStream : public common::PStream
          return 0;
       }
 
-      SynchronizeForRead(readLock);
-
-      auto size = mem->GetSize();
+      // Pairs with the barrier in Write(), so that everything up to len
+      // has been written.
+      //
+      size_t size = this->len;
+      memory_barrier();
       if (pos >= size)
          return 0;
 
+      SynchronizeForRead(readLock);
+
       size_t r = (MIN(pos + len, size)) - pos;
-      memcpy(buf, (char*)mem->GetBuffer() + pos, r);
+      ForEachSegment(
+         pos,
+         r,
+         [&buf] (char *p, size_t n) -> void
+         {
+            memcpy(buf, p, n);
+            buf = (char*)buf + n;
+         }
+      );
+      return r;
+   }
+
+   // Points into the buffer if nobody can move it out from under us,
+   // unless the range spans chunks.
+   //
+   void
+   AcquireView(uint64_t pos, size_t len, View *view, error *err)
+   {
+      size_t size = this->len;
+      memory_barrier();
+
+      if (pos < size &&
+          (mem->StableAddresses || !mem->Writeable ||
+           locking == common::NoSynchronization))
+      {
+         size_t n = 0;
+         void *p = mem->GetSegment(pos, n);
+
+         len = MIN(len, size - pos);
+         if (n >= len)
+         {
+            *view = View();
+            view->Data = p;
+            view->Length = len;
+            return;
+         }
+      }
+
+      PStream::AcquireView(pos, len, view, err);
+   }
+
+   // Under the same conditions as AcquireView(), writes to dst straight
+   // from the buffer, one write per segment.
+   //
+   uint64_t
+   CopyTo(uint64_t pos, uint64_t len, PStream *dst, uint64_t dstPos, error *err)
+   {
+      size_t size = this->len;
+      uint64_t r = 0;
+
+      memory_barrier();
+
+      if (!mem->StableAddresses && mem->Writeable &&
+          locking != common::NoSynchronization)
+      {
+         return PStream::CopyTo(pos, len, dst, dstPos, err);
+      }
+
+      if (pos >= size)
+         goto exit;
+
+      len = MIN(len, size - pos);
+      while (r < len)
+      {
+         size_t n = 0;
+         void *p = mem->GetSegment(pos + r, n);
+
+         n = MIN(n, len - r);
+         common::internal::WriteAll(dst, p, n, dstPos + r, err);
+         ERROR_CHECK(err);
+         r += n;
+      }
+   exit:
       return r;
    }
 
@@ -272,9 +521,29 @@ struct MemoryStream : public common::PStream
          ERROR_CHECK(err);
       }
 
-      memcpy((char*)mem->GetBuffer() + pos, buf, len);
+      // Like a file, a gap left by writing past the end reads as zeroes,
+      // even if Truncate() left old data there.
+      //
+      if (pos > this->len)
+      {
+         ForEachSegment(
+            this->len,
+            pos - this->len,
+            [] (char *p, size_t n) -> void { memset(p, 0, n); }
+         );
+      }
+
+      ForEachSegment(
+         pos,
+         len,
+         [&buf] (char *p, size_t n) -> void
+         {
+            memcpy(p, buf, n);
+            buf = (const char*)buf + n;
+         }
+      );
       memory_barrier();
-      if (pos+len > len)
+      if (pos+len > this->len)
          this->len = pos+len;
 
       return len;
@@ -346,6 +615,42 @@ exit:
    obj = p;
 }
 
+void
+common::CreateMemoryStreamBuffer(
+   size_t initialSize,
+   const MemoryStreamBufferOptions &options,
+   common::MemoryStreamBuffer *&obj,
+   error *err
+)
+{
+   MemoryStreamBufferChunked *p = nullptr;
+
+   if (!options.ChunkSize)
+   {
+      CreateMemoryStreamBuffer(initialSize, obj, err);
+      return;
+   }
+
+   New(&p, err);
+   ERROR_CHECK(err);
+
+   p->SetChunkSize(options.ChunkSize);
+
+   if (initialSize)
+   {
+      p->Resize(initialSize, err);
+      ERROR_CHECK(err);
+   }
+
+exit:
+   if (ERROR_FAILED(err) && p)
+   {
+      delete p;
+      p = nullptr;
+   }
+   obj = p;
+}
+
 void
 common::CreateMemoryStream(
    common::MemoryStreamBuffer *&buf,
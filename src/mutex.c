@@ -12,13 +12,185 @@
 #include <pthread_spis.h>
 #endif
 
+#if defined(MUTEX_FUTEX)
+#include <common/misc.h>
+#include <common/spin.h>
+#include <common/thread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#endif
+
 #include <assert.h>
 
+#if defined(MUTEX_FUTEX)
+
+// Upper bound on pause instructions spent waiting for the lock before
+// sleeping; about as long as a short critical section.
+//
+#define MUTEX_MAX_SPIN 100
+
+static int
+futex(int *addr, int op, int val, unsigned bitset)
+{
+   return syscall(SYS_futex, addr, op | FUTEX_PRIVATE_FLAG, val, NULL, NULL, bitset);
+}
+
+// Spinning only helps if the holder can run at the same time.
+//
+static int
+should_spin(void)
+{
+   static int cpus;
+   int n = __atomic_load_n(&cpus, __ATOMIC_RELAXED);
+   if (!n)
+   {
+      n = get_cpu_count();
+      __atomic_store_n(&cpus, n, __ATOMIC_RELAXED);
+   }
+   return n > 1;
+}
+
+static void
+count(unsigned long *counter)
+{
+   __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+//
+// The default mode follows Drepper's "Futexes Are Tricky": state is 0
+// when unlocked, 1 when locked, and 2 when a thread may be asleep in
+// futex_wait() and release must wake one.  Before sleeping, a thread
+// spins for about as long as spinning has recently taken to succeed, as
+// glibc's adaptive mutexes do.
+//
+
+static void
+mutex_acquire_unfair(mutex *m)
+{
+   int c = 0;
+
+   if (__atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return;
+
+   count(&m->contended);
+
+   if (should_spin())
+   {
+      int spin = __atomic_load_n(&m->spin, __ATOMIC_RELAXED);
+      int max = MIN(MUTEX_MAX_SPIN, spin * 2 + 10);
+      int i;
+
+      for (i=0; i<max; ++i)
+      {
+         spin_pause();
+         c = 0;
+         if (__atomic_load_n(&m->state, __ATOMIC_RELAXED) == 0 &&
+             __atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+      }
+
+      __atomic_store_n(&m->spin, spin + (i - spin) / 8, __ATOMIC_RELAXED);
+      if (i < max)
+         return;
+   }
+
+   while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE))
+   {
+      count(&m->sleeps);
+      futex(&m->state, FUTEX_WAIT, 2, 0);
+   }
+}
+
+static void
+mutex_release_unfair(mutex *m)
+{
+   if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+      futex(&m->state, FUTEX_WAKE, 1, 0);
+}
+
+//
+// MUTEX_FAIR is a ticket lock.  Sleepers wait on now_serving, in a
+// bitset chosen by their ticket, so that release wakes only the next in
+// line (and whoever shares its bit), not every waiter.  state counts the
+// sleepers, so that release can skip the system call without them.
+//
+
+static unsigned
+ticket_bit(unsigned ticket)
+{
+   return 1U << (ticket % 32);
+}
+
+static void
+mutex_acquire_fair(mutex *m)
+{
+   unsigned ticket = __atomic_fetch_add(&m->next_ticket, 1, __ATOMIC_RELAXED);
+   unsigned serving = __atomic_load_n(&m->now_serving, __ATOMIC_ACQUIRE);
+   int i;
+
+   if (serving == ticket)
+      return;
+
+   count(&m->contended);
+
+   // Once there is a queue, a thread in it waits for everyone ahead of it;
+   // only the first in line has a chance of the spin paying off.
+   //
+   if (should_spin() && ticket - serving == 1)
+   {
+      for (i=0; i<MUTEX_MAX_SPIN; ++i)
+      {
+         spin_pause();
+         if (__atomic_load_n(&m->now_serving, __ATOMIC_ACQUIRE) == ticket)
+            return;
+      }
+   }
+
+   for (;;)
+   {
+      __atomic_fetch_add(&m->state, 1, __ATOMIC_SEQ_CST);
+      serving = __atomic_load_n(&m->now_serving, __ATOMIC_SEQ_CST);
+      if (serving != ticket)
+      {
+         count(&m->sleeps);
+         futex((int*)&m->now_serving, FUTEX_WAIT_BITSET, serving, ticket_bit(ticket));
+      }
+      __atomic_fetch_sub(&m->state, 1, __ATOMIC_RELAXED);
+      if (__atomic_load_n(&m->now_serving, __ATOMIC_ACQUIRE) == ticket)
+         break;
+   }
+}
+
+static void
+mutex_release_fair(mutex *m)
+{
+   unsigned next = m->now_serving + 1;
+
+   __atomic_store_n(&m->now_serving, next, __ATOMIC_SEQ_CST);
+
+   if (__atomic_load_n(&m->state, __ATOMIC_SEQ_CST))
+      futex((int*)&m->now_serving, FUTEX_WAKE_BITSET, INT_MAX, ticket_bit(next));
+}
+
+#endif
+
 void
 mutex_init(mutex *m, error *err)
+{
+   mutex_init_flags(m, 0, err);
+}
+
+void
+mutex_init_flags(mutex *m, int flags, error *err)
 {
 #if defined(MUTEX_WINDOWS)
    InitializeCriticalSection(&m->CriticalSection);
+#elif defined(MUTEX_FUTEX)
+   memset(m, 0, sizeof(*m));
+   m->flags = flags;
 #elif defined(MUTEX_PTHREAD)
    int r = 0;
    pthread_mutexattr_t *attr = NULL;
@@ -28,7 +200,9 @@ mutex_init(mutex *m, error *err)
    if (r)
       ERROR_SET(err, errno, r);
    attr = &attrStorage;
-   pthread_mutexattr_setpolicy_np(attr, _PTHREAD_MUTEX_POLICY_FIRSTFIT);
+   // The default policy already hands off in order.
+   if (!(flags & MUTEX_FAIR))
+      pthread_mutexattr_setpolicy_np(attr, _PTHREAD_MUTEX_POLICY_FIRSTFIT);
 #endif
    r = pthread_mutex_init(&m->m, attr);
    if (r)
@@ -46,6 +220,7 @@ mutex_destroy(mutex *m)
 {
 #if defined(MUTEX_WINDOWS)
    DeleteCriticalSection(&m->CriticalSection);
+#elif defined(MUTEX_FUTEX)
 #elif defined(MUTEX_PTHREAD)
    pthread_mutex_destroy(&m->m);
 #else
@@ -58,6 +233,11 @@ mutex_acquire(mutex *m)
 {
 #if defined(MUTEX_WINDOWS)
    EnterCriticalSection(&m->CriticalSection);
+#elif defined(MUTEX_FUTEX)
+   if (m->flags & MUTEX_FAIR)
+      mutex_acquire_fair(m);
+   else
+      mutex_acquire_unfair(m);
 #elif defined(MUTEX_PTHREAD)
    int r = pthread_mutex_lock(&m->m);
    assert(!r); // XXX
@@ -71,6 +251,11 @@ mutex_release(mutex *m)
 {
 #if defined(MUTEX_WINDOWS)
    LeaveCriticalSection(&m->CriticalSection);
+#elif defined(MUTEX_FUTEX)
+   if (m->flags & MUTEX_FAIR)
+      mutex_release_fair(m);
+   else
+      mutex_release_unfair(m);
 #elif defined(MUTEX_PTHREAD)
    int r = pthread_mutex_unlock(&m->m);
    assert(!r); // XXX
@@ -79,3 +264,14 @@ mutex_release(mutex *m)
 #endif
 }
 
+void
+mutex_get_stats(mutex *m, struct mutex_stats *stats)
+{
+#if defined(MUTEX_FUTEX)
+   stats->contended = __atomic_load_n(&m->contended, __ATOMIC_RELAXED);
+   stats->sleeps = __atomic_load_n(&m->sleeps, __ATOMIC_RELAXED);
+#else
+   stats->contended = 0;
+   stats->sleeps = 0;
+#endif
+}
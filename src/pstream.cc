@@ -8,20 +8,63 @@
 
 #include <common/c++/stream.h>
 #include <common/c++/new.h>
+#include <common/c++/lock.h>
 #include <common/path.h>
 #include <common/misc.h>
+#include <common/mutex.h>
 #include <common/size.h>
 
+#include <atomic>
+#include <new>
+#include <string.h>
+
+#include "asyncio.h"
+
 #if defined(_WINDOWS)
 #include <windows.h>
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
+
+// macOS only has these since 11.0.
+//
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#define HAVE_PREADV
+#endif
+
+#if !defined(IOV_MAX)
+#define IOV_MAX 16
+#endif
+
+static_assert(
+   sizeof(common::IoVec) == sizeof(struct iovec) &&
+   offsetof(common::IoVec, Base) == offsetof(struct iovec, iov_base) &&
+   offsetof(common::IoVec, Length) == offsetof(struct iovec, iov_len),
+   "IoVec must match struct iovec"
+);
 #endif
 
 namespace {
+
+// Folds what the filesystem tells us about a file's last change into
+// StreamInfo::FileGeneration.
+//
+uint64_t
+FileGeneration(uint64_t modified, uint64_t changed, uint64_t size)
+{
+   uint64_t h = modified * 0x9e3779b97f4a7c15ULL;
+   h ^= changed + (h << 6) + (h >> 2);
+   h ^= size * 0xff51afd7ed558ccdULL;
+   return h ^ (h >> 32);
+}
+
 #if defined(_WINDOWS)
 
 struct WinPStream : public common::PStream
@@ -157,8 +200,23 @@ struct WinPStream : public common::PStream
    void
    GetStreamInfo(common::StreamInfo *info, error *err)
    {
+      BY_HANDLE_FILE_INFORMATION fileInfo;
+
       info->IsRemote = fd_is_remote(handle, err);
       ERROR_CHECK(err);
+
+      if (GetFileInformationByHandle(handle, &fileInfo))
+      {
+         info->FileIdKnown = true;
+         info->DeviceId = fileInfo.dwVolumeSerialNumber;
+         info->FileId = ((uint64_t)fileInfo.nFileIndexHigh << 32) | fileInfo.nFileIndexLow;
+         info->FileGeneration =
+            FileGeneration(
+               ((uint64_t)fileInfo.ftLastWriteTime.dwHighDateTime << 32) | fileInfo.ftLastWriteTime.dwLowDateTime,
+               ((uint64_t)fileInfo.ftCreationTime.dwHighDateTime << 32) | fileInfo.ftCreationTime.dwLowDateTime,
+               ((uint64_t)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow
+            );
+      }
    exit:;
    }
 };
@@ -256,6 +314,55 @@ struct UnixPStream : public common::PStream
       );
    }
 
+#if defined(HAVE_PREADV)
+   template<typename IOFunc>
+   size_t
+   VectoredIo(IOFunc ioFunc, const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      size_t total = 0;
+
+      while (count > 0)
+      {
+         int n = MIN(count, IOV_MAX);
+         size_t want = 0;
+         ssize_t r = 0;
+
+         for (int i=0; i<n; ++i)
+            want += vec[i].Length;
+
+         r = ioFunc(fd, (const struct iovec*)vec, n, pos);
+         if (r < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            ERROR_SET(err, errno, errno);
+         }
+
+         total += r;
+         pos += r;
+         if ((size_t)r < want)
+            break;
+
+         vec += n;
+         count -= n;
+      }
+   exit:
+      return total;
+   }
+
+   size_t
+   ReadV(const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      return VectoredIo(preadv, vec, count, pos, err);
+   }
+
+   size_t
+   WriteV(const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      return VectoredIo(pwritev, vec, count, pos, err);
+   }
+#endif
+
    void
    Truncate(uint64_t length, error *err)
    {
@@ -267,10 +374,42 @@ struct UnixPStream : public common::PStream
    void
    GetStreamInfo(common::StreamInfo *info, error *err)
    {
+      struct stat buf;
+
       info->IsRemote = fd_is_remote(fd, err);
       ERROR_CHECK(err);
+
+      if (!fstat(fd, &buf))
+      {
+         info->FileIdKnown = true;
+         info->DeviceId = buf.st_dev;
+         info->FileId = buf.st_ino;
+#if defined(__APPLE__)
+         info->FileGeneration =
+            FileGeneration(
+               buf.st_mtimespec.tv_sec * 1000000000ULL + buf.st_mtimespec.tv_nsec,
+               buf.st_ctimespec.tv_sec * 1000000000ULL + buf.st_ctimespec.tv_nsec,
+               buf.st_size
+            );
+#else
+         info->FileGeneration =
+            FileGeneration(
+               buf.st_mtim.tv_sec * 1000000000ULL + buf.st_mtim.tv_nsec,
+               buf.st_ctim.tv_sec * 1000000000ULL + buf.st_ctim.tv_nsec,
+               buf.st_size
+            );
+#endif
+      }
    exit:;
    }
+
+   int
+   GetFileDescriptor(uint64_t *offset, uint64_t *limit)
+   {
+      *offset = 0;
+      *limit = UINT64_MAX;
+      return fd;
+   }
 };
 
 typedef UnixPStream PlatformPStream;
@@ -278,6 +417,123 @@ typedef UnixPStream PlatformPStream;
 #endif
 } // end namespace
 
+namespace {
+
+struct AsyncStream : public common::AsyncPStream
+{
+   PlatformPStream file;
+   common::Scheduler *scheduler;
+
+   AsyncStream() : scheduler(nullptr) {}
+
+   uint64_t GetSize(error *err)               { return file.GetSize(err); }
+   void Flush(error *err)                     { file.Flush(err); }
+   void Truncate(uint64_t length, error *err) { file.Truncate(length, err); }
+
+   void
+   GetStreamInfo(common::StreamInfo *info, error *err)
+   {
+      file.GetStreamInfo(info, err);
+   }
+
+   int
+   GetFileDescriptor(uint64_t *offset, uint64_t *limit)
+   {
+      return file.GetFileDescriptor(offset, limit);
+   }
+
+   size_t
+   Read(void *buf, size_t len, uint64_t pos, error *err)
+   {
+      return file.Read(buf, len, pos, err);
+   }
+
+   size_t
+   Write(const void *buf, size_t len, uint64_t pos, error *err)
+   {
+      return file.Write(buf, len, pos, err);
+   }
+
+   size_t
+   ReadV(const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      return file.ReadV(vec, count, pos, err);
+   }
+
+   size_t
+   WriteV(const common::IoVec *vec, int count, uint64_t pos, error *err)
+   {
+      return file.WriteV(vec, count, pos, err);
+   }
+
+   void
+   Submit(
+      bool write,
+      void *buf,
+      size_t len,
+      uint64_t pos,
+      common::IoCompletion &&onComplete,
+      error *err
+   )
+   {
+      auto req = new (std::nothrow) common::internal::AsyncIoRequest();
+      if (!req)
+         ERROR_SET(err, nomem);
+
+      req->stream = this;
+#if !defined(_WINDOWS)
+      req->fd = file.fd;
+#endif
+      req->write = write;
+      req->buf = buf;
+      req->len = len;
+      req->pos = pos;
+      req->scheduler = scheduler;
+      req->callback = std::move(onComplete);
+
+      common::internal::SubmitAsyncIo(req, err);
+   exit:;
+   }
+
+   void
+   ReadAsync(void *buf, size_t len, uint64_t pos, common::IoCompletion &&onComplete, error *err)
+   {
+      Submit(false, buf, len, pos, std::move(onComplete), err);
+   }
+
+   void
+   WriteAsync(const void *buf, size_t len, uint64_t pos, common::IoCompletion &&onComplete, error *err)
+   {
+      Submit(true, (void*)buf, len, pos, std::move(onComplete), err);
+   }
+};
+
+} // end namespace
+
+void
+common::CreateStream(
+   const char *filename,
+   common::OpenMode mode,
+   common::Scheduler *completions,
+   common::AsyncPStream **out,
+   error *err
+)
+{
+   common::Pointer<AsyncStream> r;
+
+   New(r.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   r->scheduler = completions;
+   r->file.open(filename, (common::OpenMode)(mode & ~common::OpenAsync), err);
+   ERROR_CHECK(err);
+
+exit:
+   if (ERROR_FAILED(err))
+      r = nullptr;
+   *out = r.Detach();
+}
+
 void
 common::CreateStream(
    const char *filename,
@@ -288,6 +544,14 @@ common::CreateStream(
 {
    common::Pointer<PlatformPStream> r;
 
+   if (mode & OpenAsync)
+   {
+      common::AsyncPStream *async = nullptr;
+      CreateStream(filename, mode, nullptr, &async, err);
+      *out = async;
+      return;
+   }
+
    New(r.GetAddressOf(), err);
    ERROR_CHECK(err);
 
@@ -302,6 +566,356 @@ exit:
 
 namespace {
 
+//
+// One mapping of the whole file, as large as the file was when it was
+// made.  Mappings are kept until the stream goes away, so that views
+// handed out by GetView() survive a remap.
+//
+struct FileMapping
+{
+   FileMapping *prev;
+   const char *base;
+   size_t len;
+#if defined(_WINDOWS)
+   HANDLE section;
+#endif
+
+   FileMapping()
+      : prev(nullptr),
+        base(nullptr),
+        len(0)
+#if defined(_WINDOWS)
+        , section(nullptr)
+#endif
+   {
+   }
+
+   FileMapping(const FileMapping &) = delete;
+
+   // Returns false, without setting err, if the file cannot be mapped
+   // and should be read some other way.
+   //
+   bool
+   Map(PlatformPStream &file, uint64_t size, error *err)
+   {
+      bool r = false;
+
+      if (size > SIZE_MAX)
+         goto exit;
+#if defined(_WINDOWS)
+      section = CreateFileMapping(file.handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (!section)
+         goto exit;
+      base = (const char*)MapViewOfFile(section, FILE_MAP_READ, 0, 0, size);
+      if (!base)
+         goto exit;
+#else
+      {
+         void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, file.fd, 0);
+         if (p == MAP_FAILED)
+         {
+            if (errno == ENOMEM)
+               ERROR_SET(err, nomem);
+            goto exit;
+         }
+         base = (const char*)p;
+      }
+#endif
+      len = size;
+      r = true;
+   exit:
+      return r;
+   }
+
+   ~FileMapping()
+   {
+#if defined(_WINDOWS)
+      if (base)
+         UnmapViewOfFile(base);
+      if (section)
+         CloseHandle(section);
+#else
+      if (base)
+         munmap((void*)base, len);
+#endif
+   }
+};
+
+struct MappedStream : public common::MappedPStream
+{
+   PlatformPStream file;
+   std::atomic<bool> mappable;
+   std::atomic<FileMapping*> current;
+   std::atomic<uint64_t> knownSize;
+   mutex remapLock;
+
+   MappedStream() : mappable(false), current(nullptr), knownSize(0)
+   {
+      memset(&remapLock, 0, sizeof(remapLock));
+   }
+
+   ~MappedStream()
+   {
+      auto m = current.load();
+      while (m)
+      {
+         auto prev = m->prev;
+         delete m;
+         m = prev;
+      }
+      mutex_destroy(&remapLock);
+   }
+
+   void
+   open(const char *filename, error *err)
+   {
+      common::StreamInfo info;
+      uint64_t size = 0;
+
+      mutex_init(&remapLock, err);
+      ERROR_CHECK(err);
+
+      file.open(filename, common::OpenMode::ReadOnly, err);
+      ERROR_CHECK(err);
+
+      // Pipes and devices cannot be mapped, and pages of a file on a
+      // network share can vanish from under us.  Those are read instead.
+      //
+#if defined(_WINDOWS)
+      if (GetFileType(file.handle) != FILE_TYPE_DISK)
+         goto exit;
+#else
+      {
+         struct stat buf;
+         if (fstat(file.fd, &buf))
+            ERROR_SET(err, errno, errno);
+         if (!S_ISREG(buf.st_mode))
+            goto exit;
+      }
+#endif
+
+      file.GetStreamInfo(&info, err);
+      ERROR_CHECK(err);
+      if (info.IsRemote)
+         goto exit;
+
+      size = file.GetSize(err);
+      ERROR_CHECK(err);
+      knownSize = size;
+
+      mappable = true;
+      if (size)
+      {
+         Remap(size, err);
+         ERROR_CHECK(err);
+      }
+   exit:;
+   }
+
+   // Maps the file again if it has grown past the current mapping.
+   // Returns the newest mapping, which may be null if the file is empty
+   // or could not be mapped.
+   //
+   FileMapping *
+   Remap(uint64_t needed, error *err)
+   {
+      common::locker l;
+      FileMapping *m = nullptr;
+      FileMapping *prev = nullptr;
+      uint64_t size = 0;
+
+      l.acquire(remapLock);
+
+      prev = current.load(std::memory_order_relaxed);
+      if (!mappable || (prev && prev->len >= needed))
+         goto exit;
+
+      size = file.GetSize(err);
+      ERROR_CHECK(err);
+      knownSize = size;
+      if (prev && prev->len >= size)
+         goto exit;
+
+      m = new (std::nothrow) FileMapping();
+      if (!m)
+         ERROR_SET(err, nomem);
+
+      if (!m->Map(file, size, err))
+      {
+         ERROR_CHECK(err);
+
+         // Could not map it after all; serve everything by reading.
+         //
+         mappable = false;
+         goto exit;
+      }
+
+      m->prev = prev;
+      current.store(m, std::memory_order_release);
+      m = nullptr;
+   exit:
+      delete m;
+      return current.load(std::memory_order_relaxed);
+   }
+
+   // Returns the newest mapping, mapping again first if it falls short
+   // of pos + len.  A range inside the mapping costs nothing.  One that
+   // reaches the size we last saw asks the filesystem once, and only
+   // takes remapLock if the file has grown.
+   //
+   FileMapping *
+   GetMapping(uint64_t pos, size_t len, error *err)
+   {
+      auto m = current.load(std::memory_order_acquire);
+      uint64_t end = pos + len;
+      uint64_t size = 0;
+
+      if (!mappable || (m && end <= m->len))
+         goto exit;
+
+      if (end > knownSize.load(std::memory_order_relaxed))
+      {
+         size = GetSize(err);
+         ERROR_CHECK(err);
+         end = MIN(end, size);
+         if (m ? end <= m->len : !end)
+            goto exit;
+      }
+
+      m = Remap(end, err);
+   exit:
+      return m;
+   }
+
+   uint64_t
+   GetSize(error *err)
+   {
+      uint64_t r = file.GetSize(err);
+      if (!ERROR_FAILED(err))
+         knownSize = r;
+      return r;
+   }
+
+   void
+   GetStreamInfo(common::StreamInfo *info, error *err)
+   {
+      file.GetStreamInfo(info, err);
+   }
+
+   int
+   GetFileDescriptor(uint64_t *offset, uint64_t *limit)
+   {
+      return file.GetFileDescriptor(offset, limit);
+   }
+
+   size_t
+   Read(void *buf, size_t len, uint64_t pos, error *err)
+   {
+      size_t r = 0;
+      FileMapping *m = GetMapping(pos, len, err);
+      ERROR_CHECK(err);
+
+      if (m && pos + len <= m->len)
+         r = len;
+      else if (!mappable)
+         return file.Read(buf, len, pos, err);
+      else if (m && pos < m->len)
+         r = m->len - pos;
+
+      if (r)
+         memcpy(buf, m->base + pos, r);
+   exit:
+      return r;
+   }
+
+   // Mappings live as long as the stream, so there is nothing to release.
+   //
+   void
+   AcquireView(uint64_t pos, size_t len, View *view, error *err)
+   {
+      FileMapping *m = GetMapping(pos, len, err);
+      ERROR_CHECK(err);
+
+      if (!mappable)
+      {
+         PStream::AcquireView(pos, len, view, err);
+         goto exit;
+      }
+
+      *view = View();
+      if (m && pos < m->len)
+      {
+         view->Data = m->base + pos;
+         view->Length = MIN(len, m->len - pos);
+      }
+   exit:;
+   }
+
+   uint64_t
+   CopyTo(uint64_t pos, uint64_t len, PStream *dst, uint64_t dstPos, error *err)
+   {
+      uint64_t r = 0;
+      FileMapping *m = GetMapping(pos, len, err);
+      ERROR_CHECK(err);
+
+      if (!mappable)
+         return PStream::CopyTo(pos, len, dst, dstPos, err);
+
+      if (m && pos < m->len)
+      {
+         r = MIN(len, m->len - pos);
+         common::internal::WriteAll(dst, m->base + pos, r, dstPos, err);
+         ERROR_CHECK(err);
+      }
+   exit:
+      return r;
+   }
+
+   const void *
+   GetView(uint64_t pos, size_t len, error *err)
+   {
+      const void *r = nullptr;
+      FileMapping *m = GetMapping(pos, len, err);
+      ERROR_CHECK(err);
+
+      if (!m || pos + len > m->len)
+      {
+         if (!mappable)
+            ERROR_SET(err, notimpl);
+         ERROR_SET(err, unknown, "View out of bounds");
+      }
+
+      r = m->base + pos;
+   exit:
+      return r;
+   }
+};
+
+} // end namespace
+
+void
+common::CreateMappedStream(
+   const char *filename,
+   MappedPStream **out,
+   error *err
+)
+{
+   common::Pointer<MappedStream> r;
+
+   New(r.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   r->open(filename, err);
+   ERROR_CHECK(err);
+
+exit:
+   if (ERROR_FAILED(err))
+      r = nullptr;
+   *out = r.Detach();
+}
+
+namespace {
+
 struct StreamWrapper : public common::Stream
 {
    common::Pointer<common::PStream> stream;
@@ -361,6 +975,26 @@ struct StreamWrapper : public common::Stream
       return r;
    }
 
+   size_t
+   ReadV(const common::IoVec *vec, int count, error *err)
+   {
+      auto r = stream->ReadV(vec, count, pos, err);
+      ERROR_CHECK(err);
+      pos += r;
+   exit:
+      return r;
+   }
+
+   size_t
+   WriteV(const common::IoVec *vec, int count, error *err)
+   {
+      auto r = stream->WriteV(vec, count, pos, err);
+      ERROR_CHECK(err);
+      pos += r;
+   exit:
+      return r;
+   }
+
    void
    Truncate(uint64_t length, error *err)
    {
@@ -390,6 +1024,165 @@ exit:
    return 0;
 }
 
+size_t
+common::PStream::ReadV(const IoVec *vec, int count, uint64_t pos, error *err)
+{
+   return internal::IoVecLoop(
+      vec,
+      count,
+      [this, &pos] (void *buf, size_t len, error *err) -> size_t
+      {
+         size_t r = Read(buf, len, pos, err);
+         pos += r;
+         return r;
+      },
+      err
+   );
+}
+
+size_t
+common::PStream::WriteV(const IoVec *vec, int count, uint64_t pos, error *err)
+{
+   return internal::IoVecLoop(
+      vec,
+      count,
+      [this, &pos] (const void *buf, size_t len, error *err) -> size_t
+      {
+         size_t r = Write(buf, len, pos, err);
+         pos += r;
+         return r;
+      },
+      err
+   );
+}
+
+void
+common::PStream::AcquireView(uint64_t pos, size_t len, View *view, error *err)
+{
+   char *buf = nullptr;
+   uint64_t size = 0;
+
+   *view = View();
+
+   // Don't allocate for more than the stream holds; callers may ask for a
+   // large window and expect a short view at the end.
+   //
+   size = GetSize(err);
+   ERROR_CHECK(err);
+   if (pos >= size)
+      goto exit;
+   if (len > size - pos)
+      len = size - pos;
+
+   buf = new (std::nothrow) char[len ? len : 1];
+   if (!buf)
+      ERROR_SET(err, nomem);
+
+   view->Length = Read(buf, len, pos, err);
+   ERROR_CHECK(err);
+
+   view->Data = buf;
+   view->Context = buf;
+   view->Release = [] (void *context) -> void { delete [] (char*)context; };
+   buf = nullptr;
+exit:
+   delete [] buf;
+}
+
+void
+common::PStream::ReleaseView(View *view)
+{
+   if (view->Release)
+      view->Release(view->Context);
+   *view = View();
+}
+
+int
+common::PStream::GetFileDescriptor(uint64_t *offset, uint64_t *limit)
+{
+   return -1;
+}
+
+uint64_t
+common::PStream::CopyTo(uint64_t pos, uint64_t len, PStream *dst, uint64_t dstPos, error *err)
+{
+   const size_t bufferSize = 1024 * 1024;
+   char *buf = nullptr;
+   uint64_t total = 0;
+
+   if (!len)
+      goto exit;
+
+   buf = new (std::nothrow) char[MIN(len, bufferSize)];
+   if (!buf)
+      ERROR_SET(err, nomem);
+
+   while (len)
+   {
+      size_t r = Read(buf, MIN(len, bufferSize), pos, err);
+      ERROR_CHECK(err);
+      if (!r)
+         break;
+
+      common::internal::WriteAll(dst, buf, r, dstPos, err);
+      ERROR_CHECK(err);
+
+      pos += r;
+      dstPos += r;
+      total += r;
+      len -= r;
+   }
+
+exit:
+   delete [] buf;
+   return total;
+}
+
+void
+common::internal::WriteAll(PStream *dst, const void *buf, size_t len, uint64_t pos, error *err)
+{
+   while (len)
+   {
+      size_t r = dst->Write(buf, len, pos, err);
+      ERROR_CHECK(err);
+      if (!r)
+         ERROR_SET(err, unknown, "Short write");
+      buf = (const char*)buf + r;
+      len -= r;
+      pos += r;
+   }
+exit:;
+}
+
+uint64_t
+common::CopyStream(
+   PStream *src,
+   uint64_t srcPos,
+   PStream *dst,
+   uint64_t dstPos,
+   uint64_t len,
+   error *err
+)
+{
+#if !defined(_WINDOWS)
+   uint64_t srcOffset = 0, srcLimit = 0, dstOffset = 0, dstLimit = 0;
+   int srcFd = src->GetFileDescriptor(&srcOffset, &srcLimit);
+   int dstFd = dst->GetFileDescriptor(&dstOffset, &dstLimit);
+
+   if (srcFd >= 0 && dstFd >= 0)
+   {
+      if (srcPos >= srcLimit || dstPos >= dstLimit)
+         return 0;
+
+      len = MIN(len, srcLimit - srcPos);
+      len = MIN(len, dstLimit - dstPos);
+      return copy_fd_range(srcFd, srcOffset + srcPos, dstFd, dstOffset + dstPos, len, err);
+   }
+#endif
+
+   return src->CopyTo(srcPos, len, dst, dstPos, err);
+}
+
 void
 common::PStream::ToStream(common::Stream **out, error *err)
 {
@@ -423,7 +1216,14 @@ struct SubstreamWrapper : public common::PStream
       len = length;
    exit:;
    }
-   void GetStreamInfo(common::StreamInfo *info, error *err) {baseStream->GetStreamInfo(info, err); }
+   // Only part of the file, so it is not the same as the whole file.
+   //
+   void
+   GetStreamInfo(common::StreamInfo *info, error *err)
+   {
+      baseStream->GetStreamInfo(info, err);
+      info->FileIdKnown = false;
+   }
 
    void
    Translate(uint64_t &callerPos, size_t &callerLen, error *err)
@@ -454,6 +1254,41 @@ struct SubstreamWrapper : public common::PStream
       return r;
    }
 
+   void
+   AcquireView(uint64_t pos, size_t len, View *view, error *err)
+   {
+      *view = View();
+      if (pos >= this->len)
+         return;
+      Translate(pos, len, err);
+      ERROR_CHECK(err);
+      baseStream->AcquireView(pos, len, view, err);
+   exit:;
+   }
+
+   void ReleaseView(View *view) { baseStream->ReleaseView(view); }
+
+   int
+   GetFileDescriptor(uint64_t *offset, uint64_t *limit)
+   {
+      int fd = baseStream->GetFileDescriptor(offset, limit);
+      if (fd >= 0)
+      {
+         *limit = (pos < *limit) ? MIN(*limit - pos, len) : 0;
+         *offset += pos;
+      }
+      return fd;
+   }
+
+   uint64_t
+   CopyTo(uint64_t pos, uint64_t len, PStream *dst, uint64_t dstPos, error *err)
+   {
+      if (pos >= this->len)
+         return 0;
+      len = MIN(len, this->len - pos);
+      return baseStream->CopyTo(this->pos + pos, len, dst, dstPos, err);
+   }
+
    void
    ToStream(common::Stream **stream, error *err)
    {
@@ -16,32 +16,26 @@ struct WeakPointerControlBlock
 {
    refcnt ref;
    RefCountable * volatile ptr;
-#if defined(__cpp_lib_shared_mutex)
-   std::shared_mutex lock;
-#else
-   rwlock lock;
-#endif
+
+   // Every Release() of the object takes this shared; only a weak
+   // pointer's Lock() takes it exclusive.
+   //
+   rwlock_biased lock;
 
    WeakPointerControlBlock() : ref(1), ptr(nullptr)
    {
-#if !defined(__cpp_lib_shared_mutex)
       memset(&lock, 0, sizeof(lock));
-#endif
    }
 
    ~WeakPointerControlBlock()
    {
-#if !defined(__cpp_lib_shared_mutex)
-      rwlock_destroy(&lock);
-#endif
+      rwlock_biased_destroy(&lock);
    }
 
    void
    Initialize(error *err)
    {
-#if !defined(__cpp_lib_shared_mutex)
-      rwlock_init(&lock, err);
-#endif
+      rwlock_biased_init(&lock, err);
    }
 
    void
@@ -59,13 +53,13 @@ struct WeakPointerControlBlock
    void
    AddRef()
    {
-      refcnt_inc(&ref);
+      refcnt_inc_inline(&ref);
    }
 
    void
    Release()
    {
-      if (refcnt_dec(&ref))
+      if (refcnt_dec_inline(&ref))
          delete this;
    }
 
@@ -140,12 +134,6 @@ common::RefCountable::~RefCountable()
    }
 }
 
-void
-common::RefCountable::AddRef(void)
-{
-   refcnt_inc(&ref);
-}
-
 bool
 common::RefCountable::Release(void)
 {
@@ -154,7 +142,7 @@ common::RefCountable::Release(void)
    locker l;
    if (wpcb)
       wpcb->AcquireShared(l);
-   if ((r=(refcnt_dec(&ref)?true:false)))
+   if ((r=(refcnt_dec_inline(&ref)?true:false)))
    {
       if (wpcb)
       {
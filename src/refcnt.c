@@ -9,6 +9,22 @@
 #include <common/refcnt.h>
 #include <common/cas.h>
 
+#if defined(REFCNT_HAVE_INLINE)
+
+void
+refcnt_inc(refcnt *p)
+{
+   refcnt_inc_inline(p);
+}
+
+int
+refcnt_dec(refcnt *p)
+{
+   return refcnt_dec_inline(p);
+}
+
+#else
+
 void
 refcnt_inc(refcnt *p)
 {
@@ -30,6 +46,8 @@ refcnt_dec(refcnt *p)
    return (old == 1);
 }
 
+#endif
+
 void
 refcnt_inc_unsafe(refcnt *p)
 {
@@ -0,0 +1,154 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/rwlock-biased.h>
+#include <common/cas.h>
+#include <common/spin.h>
+#include <common/time.h>
+
+#include <string.h>
+
+//
+// Readers that got in without touching the lock.  Each slot holds the
+// lock its reader holds, or NULL.  Shared by every biased lock, so that
+// the locks themselves stay small.
+//
+#define READER_SLOTS_LOG2 12
+#define READER_SLOTS (1 << READER_SLOTS_LOG2)
+
+static void *volatile readers[READER_SLOTS];
+
+// After a writer revokes the bias, keep it off for this many times as
+// long as the revocation took, so that revoking costs at most a small
+// fraction of the time.  Times are in milliseconds, hence the +1.
+//
+#define INHIBIT_MULTIPLIER 9
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#if defined(__GNUC__)
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+// MSVC gives volatile accesses acquire and release semantics.
+#define load_acquire(p)     (*(p))
+#define store_release(p, v) (*(p) = (v))
+#endif
+
+static THREAD_LOCAL char thread_key;
+
+static void *volatile *
+reader_slot(rwlock_biased *lock)
+{
+   uintptr_t h = (uintptr_t)lock ^ ((uintptr_t)&thread_key >> 4);
+
+   h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+   return &readers[h >> (sizeof(h) * 8 - READER_SLOTS_LOG2)];
+}
+
+static bool
+is_reader_slot(void *p)
+{
+   return (char*)p >= (char*)readers &&
+          (char*)p < (char*)(readers + READER_SLOTS);
+}
+
+void
+rwlock_biased_init(rwlock_biased *lock, error *err)
+{
+   memset(lock, 0, sizeof(*lock));
+   rwlock_init(&lock->lock, err);
+   ERROR_CHECK(err);
+   lock->rbias = 1;
+exit:;
+}
+
+void
+rwlock_biased_destroy(rwlock_biased *lock)
+{
+   rwlock_destroy(&lock->lock);
+}
+
+void
+rwlock_biased_acquire_exclusive(rwlock_biased *lock)
+{
+   uint64_t start, end;
+   int i, n;
+
+   rwlock_acquire_exclusive(&lock->lock);
+
+   if (!lock->rbias)
+      return;
+
+   // Readers publish their slot and then check rbias; we clear rbias and
+   // then check their slots.  With a barrier between the two on each
+   // side, one of us sees the other.
+   //
+   store_release(&lock->rbias, 0);
+   memory_barrier();
+
+   start = get_monotonic_time_millis();
+   for (i=0; i<READER_SLOTS; ++i)
+   {
+      for (n=0; load_acquire(&readers[i]) == lock; ++n)
+      {
+         if (n < 100)
+            spin_pause();
+         else
+            spin();
+      }
+   }
+   end = get_monotonic_time_millis();
+
+   lock->inhibit_until = end + 1 + (end - start) * INHIBIT_MULTIPLIER;
+}
+
+void
+rwlock_biased_release_exclusive(rwlock_biased *lock)
+{
+   rwlock_release_exclusive(&lock->lock);
+}
+
+void *
+rwlock_biased_acquire_shared(rwlock_biased *lock)
+{
+   if (load_acquire(&lock->rbias))
+   {
+      void *volatile *slot = reader_slot(lock);
+
+      if (!*slot && compare_and_swap_pointer(slot, NULL, lock))
+      {
+         if (load_acquire(&lock->rbias))
+            return (void*)slot;
+         store_release(slot, NULL);
+      }
+   }
+
+   rwlock_acquire_shared(&lock->lock);
+
+   // Writers are held off, so nobody is revoking the bias.
+   //
+   if (!load_acquire(&lock->rbias) &&
+       get_monotonic_time_millis() >= lock->inhibit_until)
+      store_release(&lock->rbias, 1);
+
+   return lock;
+}
+
+void
+rwlock_biased_release_shared(void *token)
+{
+   if (is_reader_slot(token))
+      store_release((void *volatile *)token, NULL);
+   else
+      rwlock_release_shared(&((rwlock_biased*)token)->lock);
+}
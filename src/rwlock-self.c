@@ -25,7 +25,7 @@ rwlock_self_wakeup(struct rwlock_self *lock)
    struct waiter_node *node = NULL;
    int *inc = NULL;
 
-   if (!lock->num_writers && !lock->num_writers && lock->writers)
+   if (!lock->num_readers && !lock->num_writers && lock->writers)
    {
       // Wake up exactly one writer.
       //
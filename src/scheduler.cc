@@ -7,40 +7,156 @@
 */
 
 #include <common/c++/scheduler.h>
+#include <common/refcnt.h>
 #include <common/sem.h>
 
+#include <new>
+#include <string.h>
+
 using namespace common;
 
+namespace {
+
+// A semaphore shared by a waiting thread and the function it scheduled.
+// Whichever lets go last frees it.
+//
+struct SyncSemaphore
+{
+   semaphore sem;
+   refcnt ref;
+
+   SyncSemaphore() : ref(1) { memset(&sem, 0, sizeof(sem)); }
+   ~SyncSemaphore() { sm_destroy(&sem); }
+
+   void AddRef() { refcnt_inc_inline(&ref); }
+
+   void
+   Release()
+   {
+      if (refcnt_dec_inline(&ref))
+         delete this;
+   }
+};
+
+// Each thread keeps one semaphore for its synchronous calls, since it
+// can only be blocked in one of them at a time.
+//
+struct SyncWaiter
+{
+   SyncSemaphore *sem;
+
+   SyncWaiter() : sem(nullptr) {}
+
+   ~SyncWaiter()
+   {
+      if (sem)
+         sem->Release();
+   }
+};
+
+thread_local SyncWaiter syncWaiter;
+
+struct SyncCall
+{
+   SyncSemaphore *sem;
+   UniqueFunction<void(error*)> fn;
+
+   SyncCall(SyncSemaphore *sem_, UniqueFunction<void(error*)> &&fn_)
+      : sem(sem_), fn(std::move(fn_))
+   {
+      sem->AddRef();
+   }
+
+   SyncCall(SyncCall &&other) : sem(other.sem), fn(std::move(other.fn))
+   {
+      other.sem = nullptr;
+   }
+
+   SyncCall(const SyncCall &) = delete;
+
+   ~SyncCall()
+   {
+      if (sem)
+         sem->Release();
+   }
+
+   void
+   operator()(error *err)
+   {
+      fn(err);
+      sm_post(&sem->sem);
+   }
+};
+
+} // end namespace
+
 common::Scheduler::~Scheduler()
 {
 }
 
+void
+common::Scheduler::ScheduleBatchImpl(
+   UniqueFunction<void(error*)> *funcs,
+   int count,
+   error *err,
+   error *asyncErr,
+   SchedulePriority priority
+)
+{
+   error defaultErrorStorage;
+
+   if (!err)
+      err = &defaultErrorStorage;
+
+   for (int i=0; i<count; ++i)
+   {
+      ScheduleImpl(std::move(funcs[i]), false, err, asyncErr, priority);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
 void
 common::Scheduler::ScheduleSyncViaAsync(
-   const std::function<void(error*)> &fn,
-   std::function<void(const std::function<void(error*)> &, error *)> scheduler,
+   UniqueFunction<void(error*)> &fn,
+   const std::function<void(UniqueFunction<void(error*)> &&, error *)> &scheduler,
    error *err
 )
 {
-   semaphore sem;
-   bool initSem = false;
+   SyncSemaphore *sem = syncWaiter.sem;
 
-   sm_init(&sem, 0, err);
-   ERROR_CHECK(err);
-   initSem = true;
+   if (!sem)
+   {
+      try
+      {
+         sem = new SyncSemaphore();
+      }
+      catch (const std::bad_alloc&)
+      {
+         ERROR_SET(err, nomem);
+      }
 
-   scheduler(
-      [&sem, fn] (error *err) -> void
+      sm_init(&sem->sem, 0, err);
+      if (ERROR_FAILED(err))
       {
-         fn(err);
-         sm_post(&sem);
-      },
-      err
-   );
-   ERROR_CHECK(err);
-
-   sm_wait(&sem);
-exit:
-   if (initSem)
-      sm_destroy(&sem);
+         delete sem;
+         goto exit;
+      }
+      syncWaiter.sem = sem;
+   }
+
+   scheduler(SyncCall(sem, std::move(fn)), err);
+   if (ERROR_FAILED(err))
+   {
+      // We can't tell whether the function was queued anyway and will
+      // still post, so give this semaphore up to it.  If it was not
+      // queued, dropping the function dropped its reference.
+      //
+      syncWaiter.sem = nullptr;
+      sem->Release();
+      goto exit;
+   }
+
+   sm_wait(&sem->sem);
+exit:;
 }
@@ -10,6 +10,40 @@
 
 #include <assert.h>
 
+#if defined(MUTEX_PTHREAD) && !defined(SEMAPHORE_MACH) && !defined(SEMAPHORE_LIBDISPATCH)
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+// glibc 2.30 added sem_clockwait(), which can wait against
+// CLOCK_MONOTONIC and so is not thrown off by the wall clock being set.
+//
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define HAVE_SEM_CLOCKWAIT
+#endif
+
+static void
+timespec_add_millis(struct timespec *ts, int64_t millis)
+{
+   ts->tv_sec += millis / 1000;
+   ts->tv_nsec += (millis % 1000) * 1000000L;
+   if (ts->tv_nsec >= 1000000000L)
+   {
+      ++ts->tv_sec;
+      ts->tv_nsec -= 1000000000L;
+   }
+}
+
+#if !defined(HAVE_SEM_CLOCKWAIT)
+static int64_t
+timespec_millis_until(const struct timespec *now, const struct timespec *deadline)
+{
+   return (int64_t)(deadline->tv_sec - now->tv_sec) * 1000 +
+          (deadline->tv_nsec - now->tv_nsec) / 1000000L;
+}
+#endif
+#endif
+
 void
 sm_init(semaphore *sem, int initial, error *err)
 {
@@ -66,7 +100,10 @@ sm_wait(semaphore *sem)
 #elif defined(SEMAPHORE_LIBDISPATCH)
    dispatch_semaphore_wait(sem->sem, DISPATCH_TIME_FOREVER);
 #elif defined(MUTEX_PTHREAD)
-   int r = sem_wait(&sem->sem);
+   int r;
+
+   while ((r = sem_wait(&sem->sem)) && errno == EINTR)
+      ;
    assert(!r); // XXX
 #else
 #error
@@ -90,3 +127,57 @@ sm_post(semaphore *sem)
 #endif
 }
 
+
+bool
+sm_timed_wait(semaphore *sem, int millis)
+{
+#if defined(MUTEX_WINDOWS)
+   return WaitForSingleObject(sem->Semaphore, millis) == WAIT_OBJECT_0;
+#elif defined(SEMAPHORE_MACH)
+   mach_timespec_t ts;
+   ts.tv_sec = millis / 1000;
+   ts.tv_nsec = (millis % 1000) * 1000000;
+   return semaphore_timedwait(sem->sem, ts) == KERN_SUCCESS;
+#elif defined(SEMAPHORE_LIBDISPATCH)
+   dispatch_time_t t = dispatch_time(DISPATCH_TIME_NOW, millis * NSEC_PER_MSEC);
+   return dispatch_semaphore_wait(sem->sem, t) == 0;
+#elif defined(MUTEX_PTHREAD)
+   struct timespec deadline = {0};
+
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   timespec_add_millis(&deadline, millis);
+
+   for (;;)
+   {
+#if defined(HAVE_SEM_CLOCKWAIT)
+      if (!sem_clockwait(&sem->sem, CLOCK_MONOTONIC, &deadline))
+         return true;
+      if (errno != EINTR)
+         return false;
+#else
+      struct timespec now = {0}, ts = {0};
+      int64_t remaining;
+
+      // sem_timedwait() takes an absolute CLOCK_REALTIME deadline, so
+      // convert what is left of ours each time around.  If the wall clock
+      // is set while we sleep we may wake early; the monotonic deadline
+      // tells us to go back to sleep.
+      //
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining = timespec_millis_until(&now, &deadline);
+      if (remaining <= 0)
+         return !sem_trywait(&sem->sem);
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      timespec_add_millis(&ts, remaining);
+
+      if (!sem_timedwait(&sem->sem, &ts))
+         return true;
+      if (errno != EINTR && errno != ETIMEDOUT)
+         return false;
+#endif
+   }
+#else
+#error
+#endif
+}
@@ -38,6 +38,34 @@ exit:
    return 0;
 }
 
+size_t
+common::Stream::ReadV(const IoVec *vec, int count, error *err)
+{
+   return internal::IoVecLoop(
+      vec,
+      count,
+      [this] (void *buf, size_t len, error *err) -> size_t
+      {
+         return Read(buf, len, err);
+      },
+      err
+   );
+}
+
+size_t
+common::Stream::WriteV(const IoVec *vec, int count, error *err)
+{
+   return internal::IoVecLoop(
+      vec,
+      count,
+      [this] (const void *buf, size_t len, error *err) -> size_t
+      {
+         return Write(buf, len, err);
+      },
+      err
+   );
+}
+
 void
 common::StreamBase::Truncate(uint64_t length, error *err)
 {
@@ -429,6 +457,8 @@ common::CreateStream(
    case ReadWrite:
       modeString = "w";
       break;
+   default:
+      break;
    }
 
    if (!modeString)
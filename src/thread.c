@@ -10,6 +10,10 @@
 #include <common/mutex.h>
 #include <common/error.h>
 
+#if !defined(MUTEX_WINDOWS)
+#include <unistd.h>
+#endif
+
 #if defined(MUTEX_WINDOWS)
 #include <windows.h>
 
@@ -85,6 +89,14 @@ thread_get_self(thread_id *id)
    id->Handle = GetCurrentThread();
 }
 
+int
+get_cpu_count(void)
+{
+   SYSTEM_INFO info = {0};
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
 #elif defined(MUTEX_PTHREAD)
 
 void
@@ -153,4 +165,11 @@ thread_get_self(thread_id *id)
    id->th = pthread_self();
 }
 
+int
+get_cpu_count(void)
+{
+   long r = sysconf(_SC_NPROCESSORS_ONLN);
+   return r > 0 ? r : 1;
+}
+
 #endif
@@ -0,0 +1,361 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/c++/threadpool.h>
+#include <common/c++/lock.h>
+#include <common/refcnt.h>
+#include <common/cas.h>
+#include <string.h>
+
+#include <deque>
+
+using namespace common;
+
+struct common::internal::ThreadPoolWorker
+{
+   ThreadPool *pool;
+   int index;
+   thread_id thread;
+   mutex lock;
+   bool lockInit;
+   std::deque<ThreadPool::QueuedFunction> queue;
+
+   ThreadPoolWorker(ThreadPool *pool_, int index_)
+      : pool(pool_), index(index_), lockInit(false)
+   {
+      memset(&thread, 0, sizeof(thread));
+      memset(&lock, 0, sizeof(lock));
+   }
+
+   ~ThreadPoolWorker()
+   {
+      if (lockInit)
+         mutex_destroy(&lock);
+   }
+};
+
+namespace {
+
+thread_local common::internal::ThreadPoolWorker *currentWorker;
+
+// Takes one thread off idleCount, if there are any.
+//
+bool
+TakeIdle(volatile unsigned long *idleCount)
+{
+   unsigned long n;
+
+   do
+   {
+      n = *idleCount;
+      if (!n)
+         return false;
+   } while (!compare_and_swap(idleCount, n, n - 1));
+
+   return true;
+}
+
+} // end namespace
+
+common::ThreadPool::ThreadPool(int nthreads)
+   : idleCount(0), nextWorker(0), stopping(false)
+{
+   error err;
+
+   memset(&wakeSem, 0, sizeof(wakeSem));
+
+   if (nthreads <= 0)
+      nthreads = get_cpu_count();
+
+   sm_init(&wakeSem, 0, &err);
+   ERROR_CHECK(&err);
+
+   try
+   {
+      workers.reserve(nthreads);
+      for (int i=0; i<nthreads; ++i)
+         workers.push_back(new Worker(this, i));
+   }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(&err, nomem);
+   }
+
+   for (auto w : workers)
+   {
+      mutex_init(&w->lock, &err);
+      ERROR_CHECK(&err);
+      w->lockInit = true;
+   }
+
+   for (auto w : workers)
+   {
+      create_thread(
+         [this, w] () -> void
+         {
+            currentWorker = w;
+            Run(w);
+            currentWorker = nullptr;
+         },
+         &w->thread,
+         &err
+      );
+      ERROR_CHECK(&err);
+   }
+
+exit:
+   if (ERROR_FAILED(&err))
+   {
+      Cleanup();
+      throw std::bad_alloc();
+   }
+}
+
+common::ThreadPool::~ThreadPool()
+{
+   Cleanup();
+}
+
+void
+common::ThreadPool::Cleanup(void)
+{
+   stopping = true;
+   memory_barrier();
+
+   for (auto w : workers)
+   {
+      if (thread_is_started(&w->thread))
+         sm_post(&wakeSem);
+   }
+
+   for (auto w : workers)
+      join_thread(&w->thread);
+
+   for (auto w : workers)
+      delete w;
+   workers.clear();
+
+   sm_destroy(&wakeSem);
+}
+
+common::internal::ThreadPoolWorker *
+common::ThreadPool::GetCurrentWorker(void)
+{
+   auto w = currentWorker;
+   return (w && w->pool == this) ? w : nullptr;
+}
+
+bool
+common::ThreadPool::IsOnThread(void)
+{
+   return GetCurrentWorker() ? true : false;
+}
+
+bool
+common::ThreadPool::Pop(Worker *self, QueuedFunction &fn)
+{
+   locker l;
+   l.acquire(self->lock);
+   if (self->queue.empty())
+      return false;
+   fn = std::move(self->queue.front());
+   self->queue.pop_front();
+   return true;
+}
+
+bool
+common::ThreadPool::Steal(Worker *self, QueuedFunction &fn)
+{
+   int n = workers.size();
+
+   for (int i=1; i<n; ++i)
+   {
+      auto victim = workers[(self->index + i) % n];
+      std::deque<QueuedFunction> stolen;
+      locker l;
+
+      l.acquire(victim->lock);
+      if (victim->queue.empty())
+         continue;
+
+      // Take half of the victim's queue from the back, so that the next
+      // steal is less likely to be needed.
+      //
+      try
+      {
+         size_t take = (victim->queue.size() + 1) / 2;
+         auto start = victim->queue.end() - take;
+         stolen.assign(
+            std::make_move_iterator(start),
+            std::make_move_iterator(victim->queue.end())
+         );
+         victim->queue.erase(start, victim->queue.end());
+      }
+      catch (const std::bad_alloc&)
+      {
+         fn = std::move(victim->queue.back());
+         victim->queue.pop_back();
+         return true;
+      }
+      l.release();
+
+      fn = std::move(stolen.front());
+      stolen.pop_front();
+
+      if (stolen.size())
+      {
+         l.acquire(self->lock);
+         try
+         {
+            self->queue.insert(
+               self->queue.end(),
+               std::make_move_iterator(stolen.begin()),
+               std::make_move_iterator(stolen.end())
+            );
+         }
+         catch (const std::bad_alloc&)
+         {
+            // Run them here rather than lose them.
+            //
+            l.release();
+            for (auto &p : stolen)
+               p();
+         }
+      }
+      return true;
+   }
+
+   return false;
+}
+
+void
+common::ThreadPool::Run(Worker *self)
+{
+   QueuedFunction fn;
+
+   for (;;)
+   {
+      if (Pop(self, fn) || Steal(self, fn))
+      {
+         fn();
+         fn.fn = nullptr;
+         continue;
+      }
+
+      // Advertise that we are about to sleep, then look again.  A
+      // producer pushes and then checks idleCount, so between the two of
+      // us one will notice the other.
+      //
+      refcnt_inc(&idleCount);
+
+      if (Pop(self, fn) || Steal(self, fn) || stopping)
+      {
+         // Take ourselves back off.  If a producer got there first, it
+         // has posted, or is about to, for a sleeper that is not coming;
+         // absorb that post.
+         //
+         if (!TakeIdle(&idleCount))
+            sm_wait(&wakeSem);
+
+         if (!fn.fn)
+            break;
+         fn();
+         fn.fn = nullptr;
+         continue;
+      }
+
+      // Whoever posted took us off idleCount.
+      //
+      sm_wait(&wakeSem);
+      if (stopping)
+         break;
+   }
+}
+
+void
+common::ThreadPool::Push(
+   QueuedFunction &fn,
+   SchedulePriority priority,
+   error *err
+)
+{
+   auto w = GetCurrentWorker();
+   locker l;
+
+   if (!w)
+   {
+      unsigned long i;
+      do
+      {
+         i = nextWorker;
+      } while (!compare_and_swap(&nextWorker, i, i + 1));
+      w = workers[i % workers.size()];
+   }
+
+   l.acquire(w->lock);
+   try
+   {
+      if (priority == PriorityHigh)
+         w->queue.push_front(std::move(fn));
+      else
+         w->queue.push_back(std::move(fn));
+   }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(err, nomem);
+   }
+   l.release();
+
+   // Wake one sleeper, claiming it so that a burst of pushes does not
+   // post once for each.
+   //
+   memory_barrier();
+   if (TakeIdle(&idleCount))
+      sm_post(&wakeSem);
+exit:;
+}
+
+void
+common::ThreadPool::ScheduleImpl(
+   UniqueFunction<void(error*)> &&fn,
+   bool synchronous,
+   error *err,
+   error *asyncErr,
+   SchedulePriority priority
+)
+{
+   error defaultErrorStorage;
+
+   if (!err)
+      err = &defaultErrorStorage;
+
+   if (synchronous)
+   {
+      if (IsOnThread())
+         fn(err);
+      else
+      {
+         ScheduleSyncViaAsync(
+            fn,
+            [this, priority] (UniqueFunction<void(error*)> &&fn, error *err) -> void
+            {
+               ScheduleImpl(std::move(fn), false, err, err, priority);
+            },
+            err
+         );
+      }
+   }
+   else
+   {
+      QueuedFunction inner(std::move(fn), asyncErr);
+      Push(inner, priority, err);
+      ERROR_CHECK(err);
+   }
+
+exit:;
+}
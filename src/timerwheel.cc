@@ -0,0 +1,263 @@
+/*
+ Copyright (C) 2020 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <common/c++/timerwheel.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace common;
+
+namespace {
+
+int
+LowestBit(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+   unsigned long r = 0;
+   _BitScanForward64(&r, mask);
+   return r;
+#elif defined(__GNUC__)
+   return __builtin_ctzll(mask);
+#else
+   int r = 0;
+   while (!(mask & 1))
+   {
+      mask >>= 1;
+      ++r;
+   }
+   return r;
+#endif
+}
+
+uint64_t
+BitsAbove(int idx)
+{
+   return (idx == 63) ? 0 : (~0ULL << (idx + 1));
+}
+
+} // end namespace
+
+common::Timer::Timer(
+   UniqueFunction<void(error*)> &&fn_,
+   uint64_t expires_,
+   uint64_t period_
+)
+   : next(nullptr),
+     expires(expires_),
+     period(period_),
+     fn(std::move(fn_)),
+     cancelled(false)
+{
+}
+
+common::TimerWheel::TimerWheel(uint64_t now)
+   : current(now), far(nullptr)
+{
+   memset(slots, 0, sizeof(slots));
+   memset(occupied, 0, sizeof(occupied));
+}
+
+common::TimerWheel::~TimerWheel()
+{
+   for (auto &level : slots)
+      for (auto list : level)
+         ReleaseList(list);
+   ReleaseList(far);
+}
+
+void
+common::TimerWheel::ReleaseList(Timer *list)
+{
+   while (list)
+   {
+      auto t = list;
+      list = t->next;
+      t->Release();
+   }
+}
+
+//
+// A timer goes in the lowest level where it shares a parent slot with the
+// current tick.  That means its own slot at that level is always ahead of
+// the current one, and it is moved down a level when that slot comes up.
+//
+void
+common::TimerWheel::Link(Timer *t)
+{
+   for (int level=0; level<Levels; ++level)
+   {
+      int shift = level * SlotBits;
+
+      if ((t->expires >> (shift + SlotBits)) == (current >> (shift + SlotBits)))
+      {
+         int slot = (t->expires >> shift) & (Slots - 1);
+         t->next = slots[level][slot];
+         slots[level][slot] = t;
+         occupied[level] |= (1ULL << slot);
+         return;
+      }
+   }
+
+   t->next = far;
+   far = t;
+}
+
+void
+common::TimerWheel::Insert(Timer *t)
+{
+   t->AddRef();
+   if (t->expires <= current)
+      t->expires = current + 1;
+   Link(t);
+}
+
+void
+common::TimerWheel::Cascade(Timer *list, Timer **due)
+{
+   while (list)
+   {
+      auto t = list;
+      list = t->next;
+
+      if (t->cancelled)
+      {
+         t->fn = nullptr;
+         t->Release();
+      }
+      else if (t->expires <= current)
+      {
+         t->next = *due;
+         *due = t;
+      }
+      else
+         Link(t);
+   }
+}
+
+void
+common::TimerWheel::Fire(Timer *list)
+{
+   while (list)
+   {
+      auto t = list;
+      list = t->next;
+
+      if (!t->cancelled)
+      {
+         error err;
+         t->fn(&err);
+      }
+
+      if (t->period && !t->cancelled)
+      {
+         // If we have fallen behind, skip the missed runs rather than
+         // firing them back to back.
+         //
+         t->expires += t->period;
+         if (t->expires <= current)
+            t->expires = current + t->period;
+         Link(t);
+      }
+      else
+      {
+         t->fn = nullptr;
+         t->Release();
+      }
+   }
+}
+
+uint64_t
+common::TimerWheel::NextTick(void) const
+{
+   for (int level=0; level<Levels; ++level)
+   {
+      int shift = level * SlotBits;
+      int idx = (current >> shift) & (Slots - 1);
+      uint64_t mask = occupied[level] & BitsAbove(idx);
+
+      if (mask)
+      {
+         uint64_t base = (current >> (shift + SlotBits)) << (shift + SlotBits);
+         return base + ((uint64_t)LowestBit(mask) << shift);
+      }
+   }
+
+   if (far)
+      return ((current >> (Levels * SlotBits)) + 1) << (Levels * SlotBits);
+
+   return UINT64_MAX;
+}
+
+void
+common::TimerWheel::Advance(uint64_t now)
+{
+   uint64_t tick;
+
+   while ((tick = NextTick()) <= now)
+   {
+      Timer *due = nullptr;
+
+      current = tick;
+
+      // Crossing into a new slot at a higher level; spread its timers
+      // out over the levels below, from the top down.
+      //
+      if (!(tick & ((1ULL << (Levels * SlotBits)) - 1)))
+      {
+         auto list = far;
+         far = nullptr;
+         Cascade(list, &due);
+      }
+
+      for (int level=Levels-1; level>0; --level)
+      {
+         int shift = level * SlotBits;
+
+         if (tick & ((1ULL << shift) - 1))
+            continue;
+
+         int slot = (tick >> shift) & (Slots - 1);
+         auto list = slots[level][slot];
+         slots[level][slot] = nullptr;
+         occupied[level] &= ~(1ULL << slot);
+         Cascade(list, &due);
+      }
+
+      int slot = tick & (Slots - 1);
+      auto list = slots[0][slot];
+      slots[0][slot] = nullptr;
+      occupied[0] &= ~(1ULL << slot);
+      while (list)
+      {
+         auto t = list;
+         list = t->next;
+         t->next = due;
+         due = t;
+      }
+
+      Fire(due);
+   }
+
+   // Nothing is linked between here and now.
+   //
+   if (now > current)
+      current = now;
+}
+
+int64_t
+common::TimerWheel::GetTimeout(uint64_t now) const
+{
+   uint64_t tick = NextTick();
+
+   if (tick == UINT64_MAX)
+      return -1;
+   return (tick > now) ? (tick - now) : 0;
+}
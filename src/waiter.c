@@ -9,6 +9,7 @@
 #include <common/waiter.h>
 #include <common/cas.h>
 #include <common/spin.h>
+#include <common/time.h>
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -20,7 +21,27 @@
 #endif
 
 #if defined(__linux__)
-#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#elif !defined(_WINDOWS)
+#include <poll.h>
+#endif
+
+#if defined(__linux__)
+
+static int
+futex_wait(int *addr, int val, const struct timespec *timeout)
+{
+   return syscall(SYS_futex, addr, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, val, timeout, NULL, 0);
+}
+
+static void
+futex_wake(int *addr)
+{
+   syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL, NULL, 0);
+}
+
 #endif
 
 void
@@ -29,12 +50,7 @@ waiter_node_init(struct waiter_node *node)
    memset(node, 0, sizeof(*node));
 #if defined(_WINDOWS)
    node->event = CreateEvent(NULL, FALSE, FALSE, NULL);
-#else
-#if defined(__linux__)
-   node->pipe[0] = node->pipe[1] = eventfd(0, EFD_CLOEXEC);
-   if (node->pipe[0] >= 0)
-      return;
-#endif
+#elif !defined(__linux__)
    if (pipe(node->pipe))
       node->pipe[0] = node->pipe[1] = -1;
 #endif
@@ -49,7 +65,7 @@ waiter_node_destroy(struct waiter_node *node)
       CloseHandle(node->event);
       node->event = NULL;
    }
-#else
+#elif !defined(__linux__)
    if (node->pipe[0] >= 0)
       close(node->pipe[0]);
    if (node->pipe[1] >= 0 && node->pipe[0] != node->pipe[1])
@@ -67,6 +83,10 @@ waiter_node_wait(struct waiter_node *node)
       WaitForSingleObject(node->event, INFINITE);
       return;
    }
+#elif defined(__linux__)
+   while (!__atomic_load_n(&node->futex, __ATOMIC_ACQUIRE))
+      futex_wait(&node->futex, 0, NULL);
+   return;
 #else
    if (node->pipe[0] >= 0)
    {
@@ -85,6 +105,63 @@ waiter_node_wait(struct waiter_node *node)
       spin();
 }
 
+bool
+waiter_node_timed_wait(struct waiter_node *node, int millis)
+{
+   uint64_t deadline = get_monotonic_time_millis() + millis;
+   uint64_t now;
+
+#if defined(_WINDOWS)
+   if (node->event)
+      return WaitForSingleObject(node->event, millis) == WAIT_OBJECT_0;
+#elif defined(__linux__)
+   while (!__atomic_load_n(&node->futex, __ATOMIC_ACQUIRE))
+   {
+      struct timespec ts;
+
+      now = get_monotonic_time_millis();
+      if (now >= deadline)
+         return false;
+
+      ts.tv_sec = (deadline - now) / 1000;
+      ts.tv_nsec = ((deadline - now) % 1000) * 1000000L;
+      futex_wait(&node->futex, 0, &ts);
+   }
+   return true;
+#else
+   if (node->pipe[0] >= 0)
+   {
+      struct pollfd pfd;
+      int r = 0;
+
+      pfd.fd = node->pipe[0];
+      pfd.events = POLLIN;
+
+      do
+      {
+         now = get_monotonic_time_millis();
+         if (now >= deadline)
+            return false;
+         r = poll(&pfd, 1, (int)(deadline - now));
+      } while (r < 0 && errno == EINTR);
+
+      if (r <= 0)
+         return false;
+
+      waiter_node_wait(node);
+      return true;
+   }
+#endif
+   while (!node->wakeup)
+   {
+      now = get_monotonic_time_millis();
+      if (now >= deadline)
+         return false;
+      spin();
+   }
+   return true;
+}
+
 void
 waiter_node_signal(struct waiter_node *node)
 {
@@ -94,6 +171,14 @@ waiter_node_signal(struct waiter_node *node)
       SetEvent(node->event);
       return;
    }
+#elif defined(__linux__)
+   // The waiter may return and free the node as soon as it sees the
+   // store.  Waking an address after that is harmless: at worst some
+   // other futex on it wakes up early and checks its condition again.
+   //
+   __atomic_store_n(&node->futex, 1, __ATOMIC_RELEASE);
+   futex_wake(&node->futex);
+   return;
 #else
    if (node->pipe[1] >= 0)
    {
@@ -8,115 +8,228 @@
 
 #include <common/c++/worker.h>
 #include <common/c++/lock.h>
+#include <common/spin.h>
+#include <common/time.h>
+#include <limits.h>
 #include <string.h>
 
 using namespace common;
 
-struct common::WorkerThreadBase::SlowPathQueueNode
+namespace {
+
+// How many times a lane with work may be passed over for a higher
+// priority one before it gets a turn anyway.
+//
+const int StarvationLimit = 8;
+
+} // end namespace
+
+common::WorkerThreadBase::Lane &
+common::WorkerThreadBase::GetLane(SchedulePriority priority)
 {
-   std::function<void(void)> fn;
-   SlowPathQueueNode *next;
-};
+   if (priority < PriorityHigh || priority > PriorityBackground)
+      priority = PriorityNormal;
+   return lanes[priority];
+}
 
+//
+// Runs at most one batch of the lane's work, so that the caller can look
+// at the other lanes in between.
+//
 void
-common::WorkerThreadBase::Drain(std::function<void(void)> *funcs, int nfuncs)
+common::WorkerThreadBase::RunBatch(Lane &lane, QueuedFunction *funcs, int nfuncs)
 {
-   int r = 0;
+   int r = lane.queue.Read(funcs, nfuncs);
+   locker lock;
 
-   while ((r = queue.Read(funcs, nfuncs)))
+   // Anything in the ring was written before what is in the overflow
+   // list, so it goes first.
+   //
+   if (r)
    {
-   retry:
       for (int i=0; i<r; ++i)
       {
          auto &func = funcs[i];
          func();
-         funcs[i] = nullptr;
+         funcs[i].fn = nullptr;
       }
+      return;
    }
 
-   if (slowQueueHead)
+   if (lane.overflowPos < lane.overflowScratch.size())
    {
-      locker lock;
-      lock.acquire(producerMutex);
-      r = queue.Read(funcs, nfuncs);
-      int n = nfuncs - r;
-      auto p = funcs + r;
-      while (n && slowQueueHead)
+      size_t end = MIN(lane.overflowPos + nfuncs, lane.overflowScratch.size());
+
+      for (; lane.overflowPos < end; ++lane.overflowPos)
       {
-         *p++ = std::move(slowQueueHead->fn);
-         ++r;
-         --n;
-         SlowQueueChomp();
+         auto &fn = lane.overflowScratch[lane.overflowPos];
+         fn();
+         fn.fn = nullptr;
       }
+      return;
    }
 
-   if (r) goto retry;
+   if (!lane.overflowing)
+      return;
 
-   if (localSignal)
+   lane.overflowScratch.clear();
+   lane.overflowPos = 0;
+
+   lock.acquire(overflowMutex);
+   lane.overflowScratch.swap(lane.overflow);
+   if (!lane.overflowScratch.size())
    {
-      // The drain triggered another enqueue, don't bother
-      // going to the semaphore yet, just drain again.
+      // Nothing was added since we last looked; producers may go back
+      // to the ring.
       //
-      localSignal = false;
-      goto retry;
+      lane.overflowing = false;
+   }
+}
+
+void
+common::WorkerThreadBase::Drain(QueuedFunction *funcs, int nfuncs)
+{
+   for (;;)
+   {
+      Lane *next = nullptr;
+      Lane *starving = nullptr;
+
+      // Run a batch from the highest priority lane that has work, unless
+      // a lower one has waited too long.
+      //
+      for (auto &lane : lanes)
+      {
+         if (lane.IsEmpty())
+            continue;
+         if (!next)
+            next = &lane;
+         else if (++lane.starved >= StarvationLimit && !starving)
+            starving = &lane;
+      }
+
+      if (starving)
+         next = starving;
+
+      if (!next)
+      {
+         if (!localSignal)
+            break;
+
+         // The drain triggered another enqueue, don't bother
+         // going to the semaphore yet, just drain again.
+         //
+         localSignal = false;
+         continue;
+      }
+
+      next->starved = 0;
+      RunBatch(*next, funcs, nfuncs);
    }
 }
 
 void
-common::WorkerThreadBase::SlowQueueChomp(void)
+common::WorkerThreadBase::Write(Lane &lane, QueuedFunction &fn, error *err)
 {
-   auto p = slowQueueHead;
-   if (p)
+   locker lock;
+
+   if (!lane.overflowing && lane.queue.Write(&fn, 1))
+      return;
+
+   lock.acquire(overflowMutex);
+   try
+   {
+      lane.overflow.push_back(std::move(fn));
+   }
+   catch (const std::bad_alloc&)
    {
-      slowQueueHead = p->next;
-      if (&p->next == slowQueueTail)
-         slowQueueTail = &slowQueueHead;
-      delete p;
+      ERROR_SET(err, nomem);
    }
+   lane.overflowing = true;
+exit:;
 }
 
 void
-common::WorkerThreadBase::Write(std::function<void(void)> &fn, error *err)
+common::WorkerThreadBase::WriteBatch(
+   Lane &lane,
+   UniqueFunction<void(error*)> *funcs,
+   int count,
+   error *asyncErr,
+   error *err
+)
 {
    locker lock;
-   lock.acquire(producerMutex);
-   while (slowQueueHead && queue.Write(&slowQueueHead->fn, 1))
-      SlowQueueChomp();
-   if (slowQueueHead || !queue.Write(&fn, 1))
+   int done = 0;
+
+   if (!lane.overflowing)
    {
-      auto p = new (std::nothrow) SlowPathQueueNode();
-      if (!p)
-         ERROR_SET(err, nomem);
-      p->fn = std::move(fn); 
-      p->next = nullptr;
-      *slowQueueTail = p;
-      slowQueueTail = &p->next;
+      while (done < count)
+      {
+         int r = lane.queue.Write(
+            count - done,
+            [funcs, done, asyncErr] (QueuedFunction &slot, int j) -> void
+            {
+               slot.fn = std::move(funcs[done + j]);
+               slot.asyncErr = asyncErr;
+            }
+         );
+         if (!r)
+            break;
+         done += r;
+      }
+   }
+
+   if (done == count)
+      return;
+
+   lock.acquire(overflowMutex);
+   try
+   {
+      lane.overflow.reserve(lane.overflow.size() + count - done);
    }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(err, nomem);
+   }
+   for (; done < count; ++done)
+      lane.overflow.emplace_back(std::move(funcs[done]), asyncErr);
+   lane.overflowing = true;
 exit:;
 }
 
-std::function<void(void)>
-common::WorkerThreadBase::PrepFunction(
-   const std::function<void(error*)> &fn,
-   error *asyncErr
+void
+common::WorkerThreadBase::ScheduleBatchImpl(
+   UniqueFunction<void(error*)> *funcs,
+   int count,
+   error *err,
+   error *asyncErr,
+   SchedulePriority priority
 )
 {
-   if (asyncErr)
-      return [fn, asyncErr] () -> void { fn(asyncErr); };
+   error defaultErrorStorage;
+
+   if (!err)
+      err = &defaultErrorStorage;
+
+   if (count <= 0)
+      return;
+
+   WriteBatch(GetLane(priority), funcs, count, asyncErr, err);
+
+   // Even on failure, part of the batch may be queued.
+   //
+   if (IsOnThread())
+      localSignal = true;
    else
-      return [fn] () -> void
-             {
-                error err;
-                fn(&err);
-             };
+      Signal(err);
 }
 
 void
 common::WorkerThreadBase::ScheduleImpl(
-   const std::function<void(error *err)> &fn,
+   UniqueFunction<void(error*)> &&fn,
    bool synchronous,
    error *err,
-   error *asyncErr
+   error *asyncErr,
+   SchedulePriority priority
 )
 {
    error defaultErrorStorage;
@@ -130,8 +243,8 @@ common::WorkerThreadBase::ScheduleImpl(
          fn(err);
       else
       {
-         auto inner = PrepFunction(fn, asyncErr);
-         Write(inner, err);
+         QueuedFunction inner(std::move(fn), asyncErr);
+         Write(GetLane(priority), inner, err);
          ERROR_CHECK(err);
          localSignal = true;
       }
@@ -142,17 +255,17 @@ common::WorkerThreadBase::ScheduleImpl(
       {
          ScheduleSyncViaAsync(
             fn,
-            [this] (const std::function<void(error*)> &fn, error *err) -> void
+            [this, priority] (UniqueFunction<void(error*)> &&fn, error *err) -> void
             {
-               Schedule(fn, false, err, err);
+               ScheduleImpl(std::move(fn), false, err, err, priority);
             },
             err
          );
       }
       else
       {
-         auto inner = PrepFunction(fn, asyncErr);
-         Write(inner, err);
+         QueuedFunction inner(std::move(fn), asyncErr);
+         Write(GetLane(priority), inner, err);
          ERROR_CHECK(err);
          Signal(err);
          ERROR_CHECK(err);
@@ -165,21 +278,28 @@ exit:;
 bool
 common::WorkerThreadBase::IsEmpty(void)
 {
-   return queue.IsEmpty() && !slowQueueHead;
+   for (auto &lane : lanes)
+      if (!lane.IsEmpty())
+         return false;
+   return true;
 }
 
-common::WorkerThreadBase::WorkerThreadBase()
-   : localSignal(false),
-     slowQueueHead(nullptr),
-     slowQueueTail(&slowQueueHead)
+common::WorkerThreadBase::WorkerThreadBase(int queueDepth)
+   : localSignal(false)
 {
    error err;
 
-   memset(&producerMutex, 0, sizeof(producerMutex));
+   memset(&overflowMutex, 0, sizeof(overflowMutex));
 
-   mutex_init(&producerMutex, &err);
+   mutex_init(&overflowMutex, &err);
    ERROR_CHECK(&err);
 
+   for (auto &lane : lanes)
+   {
+      lane.queue.Initialize(queueDepth, &err);
+      ERROR_CHECK(&err);
+   }
+
 exit:
    if (ERROR_FAILED(&err))
    {
@@ -196,18 +316,27 @@ common::WorkerThreadBase::~WorkerThreadBase()
 void
 common::WorkerThreadBase::Cleanup()
 {
-   mutex_destroy(&producerMutex);
+   mutex_destroy(&overflowMutex);
 }
 
 //
 //
 //
 
-common::WorkerThread::WorkerThread()
-   : stopping(false)
+common::WorkerThread::WorkerThread(int queueDepth)
+   : WorkerThreadBase(queueDepth),
+     stopping(false),
+     parked(false),
+     spinCount(0),
+     timers(get_monotonic_time_millis())
 {
    error err;
 
+   // Spinning on a single CPU only delays the producer we are waiting for.
+   //
+   if (get_cpu_count() > 1)
+      spinCount = 1000;
+
    memset(&thread, 0, sizeof(thread));
    memset(&consumerSem, 0, sizeof(consumerSem));
 
@@ -217,14 +346,17 @@ common::WorkerThread::WorkerThread()
    create_thread(
       [this] () -> void
       {
-         std::function<void(void)> funcs[256];
+         QueuedFunction funcs[256];
 
          for (;;)
          {
             Drain(funcs, ARRAY_SIZE(funcs));
             if (stopping && IsEmpty())
                break;
-            sm_wait(&consumerSem);
+
+            auto now = get_monotonic_time_millis();
+            timers.Advance(now);
+            Park(timers.GetTimeout(now));
          }
       },
       &thread,
@@ -257,10 +389,98 @@ common::WorkerThread::Cleanup(void)
    sm_destroy(&consumerSem);
 }
 
+void
+common::WorkerThread::Park(int64_t timeoutMillis)
+{
+   // If more work shows up within a few microseconds, nobody needs to
+   // make a system call.
+   //
+   for (int i=0; i<spinCount; ++i)
+   {
+      if (stopping || !IsEmpty())
+         return;
+      spin_pause();
+   }
+
+   // Advertise that we are going to sleep, then look again.  A producer
+   // writes to the queue and then checks parked, so between the two of
+   // us one will notice the other.
+   //
+   parked = true;
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+
+   if ((stopping || !IsEmpty()) && parked.exchange(false))
+      return;
+
+   // Either nothing is queued, or a producer cleared parked first and
+   // its post is on the way.
+   //
+   if (timeoutMillis < 0)
+      sm_wait(&consumerSem);
+   else if (!sm_timed_wait(&consumerSem, MIN(timeoutMillis, INT_MAX)) &&
+            !parked.exchange(false))
+   {
+      // Timed out, but a producer got to the flag first; take its post
+      // so that the count stays balanced.
+      //
+      sm_wait(&consumerSem);
+   }
+}
+
+void
+common::WorkerThread::AddTimer(
+   uint64_t delayMillis,
+   uint64_t periodMillis,
+   UniqueFunction<void(error*)> &&func,
+   Timer **timer,
+   error *err
+)
+{
+   error defaultErrorStorage;
+   Pointer<Timer> t;
+
+   if (!err)
+      err = &defaultErrorStorage;
+
+   try
+   {
+      *t.GetAddressOf() = new Timer(
+         std::move(func),
+         get_monotonic_time_millis() + delayMillis,
+         periodMillis
+      );
+   }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (IsOnThread())
+      timers.Insert(t.Get());
+   else
+   {
+      Schedule(
+         [this, t] (error *err) -> void
+         {
+            timers.Insert(t.Get());
+         },
+         false,
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+   if (timer)
+      *timer = t.Detach();
+exit:;
+}
+
 void
 common::WorkerThread::Signal(error *err)
 {
-   sm_post(&consumerSem);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (parked.load(std::memory_order_relaxed) && parked.exchange(false))
+      sm_post(&consumerSem);
 }
 
 bool
@@ -0,0 +1,208 @@
+#include <common/c++/new.h>
+#include <common/c++/stream.h>
+#include <common/logger.h>
+#include <common/misc.h>
+#include <common/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+static const size_t blockSize = 64 * 1024;
+static const int blocks = 32;
+static const int threadCount = 8;
+
+// While set, every allocation pauses, which widens any window between a
+// thread missing a block and claiming it.
+//
+static std::atomic<bool> slowAllocations;
+
+void *
+operator new(size_t n)
+{
+   void *p;
+
+   if (slowAllocations)
+      usleep(500);
+   p = malloc(n ? n : 1);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void operator delete(void *p) noexcept           { free(p); }
+void operator delete(void *p, size_t) noexcept   { free(p); }
+
+//
+// A stream of known content that counts how often each block is read,
+// and reads slowly, so that threads pile up on the same misses.
+//
+struct CountingStream : public common::PStream
+{
+   std::atomic<int> reads[blocks];
+
+   CountingStream()
+   {
+      for (auto &r : reads)
+         r = 0;
+   }
+
+   static char
+   ByteAt(uint64_t pos)
+   {
+      return (char)(pos * 7 + pos / blockSize);
+   }
+
+   size_t
+   Read(void *buf, size_t len, uint64_t pos, error *err)
+   {
+      uint64_t size = GetSize(err);
+
+      if (pos >= size)
+         return 0;
+      len = (size_t)MIN(len, size - pos);
+
+      if (pos % blockSize == 0)
+         ++reads[pos / blockSize];
+      usleep(2000);
+
+      for (size_t i=0; i<len; ++i)
+         ((char*)buf)[i] = ByteAt(pos + i);
+      return len;
+   }
+
+   uint64_t GetSize(error *err) { return blocks * blockSize; }
+};
+
+// Every thread reads every block in the same order, all starting at
+// once, so that they miss together.
+//
+static void
+ReadAll(common::PStream *stream, error *err)
+{
+   std::vector<thread_id> threads(threadCount);
+   std::atomic<int> bad(0);
+   std::atomic<bool> go(false);
+
+   for (auto &th : threads)
+      memset(&th, 0, sizeof(th));
+
+   for (int i=0; i<threadCount; ++i)
+   {
+      common::create_thread(
+         [stream, &bad, &go] () -> void
+         {
+            std::vector<char> buf(blockSize);
+            error err;
+
+            while (!go)
+               usleep(100);
+
+            for (int j=0; j<blocks; ++j)
+            {
+               uint64_t pos = (uint64_t)j * blockSize;
+               size_t r = stream->Read(buf.data(), buf.size(), pos, &err);
+
+               if (ERROR_FAILED(&err) || r != buf.size() ||
+                   buf[0] != CountingStream::ByteAt(pos) ||
+                   buf[blockSize - 1] != CountingStream::ByteAt(pos + blockSize - 1))
+               {
+                  ++bad;
+               }
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   go = true;
+   for (auto &th : threads)
+      join_thread(&th);
+   if (!ERROR_FAILED(err) && bad)
+      error_set_unknown(err, "wrong data read through the cache");
+}
+
+// Once nothing is being read, every block in the map is on the LRU list
+// and nothing else is.
+//
+static bool
+Consistent(const char *when)
+{
+   common::BlockCacheStats stats;
+
+   common::GetBlockCacheStats(&stats);
+   printf("%s: %llu blocks, %llu bytes, %llu hits, %llu misses, %llu evictions\n",
+          when,
+          (unsigned long long)stats.Blocks,
+          (unsigned long long)stats.BytesCached,
+          (unsigned long long)stats.Hits,
+          (unsigned long long)stats.Misses,
+          (unsigned long long)stats.Evictions);
+   return stats.BytesCached == stats.Blocks * blockSize;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   common::Pointer<CountingStream> file;
+   common::Pointer<common::PStream> cached;
+   bool ok = true;
+
+   log_register_callback(log_callback, NULL);
+
+   common::New(file.GetAddressOf(), &err);
+   ERROR_CHECK(&err);
+   common::CreateCachedStream(file.Get(), cached.GetAddressOf(), &err);
+   ERROR_CHECK(&err);
+
+   // Everyone misses at once; each block should be read only once.
+   //
+   slowAllocations = true;
+   ReadAll(cached.Get(), &err);
+   slowAllocations = false;
+   ERROR_CHECK(&err);
+
+   for (int i=0; i<blocks; ++i)
+   {
+      if (file->reads[i] != 1)
+      {
+         printf("block %d read %d times\n", i, file->reads[i].load());
+         ok = false;
+      }
+   }
+   ok = Consistent("after concurrent misses") && ok;
+
+   // Again with room for about one block in each of the cache's 16
+   // shards, so that misses and evictions race.
+   //
+   common::SetBlockCacheCapacity(16 * blockSize);
+   ReadAll(cached.Get(), &err);
+   ERROR_CHECK(&err);
+   ok = Consistent("while evicting") && ok;
+
+   common::SetBlockCacheCapacity(0);
+   ok = Consistent("after dropping everything") && ok;
+
+exit:
+   if (!ok || ERROR_FAILED(&err))
+   {
+      fprintf(stderr, "FAILED\n");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,165 @@
+#include <common/c++/stream.h>
+#include <common/logger.h>
+#include <common/misc.h>
+#include <common/thread.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+static const size_t total = 1024 * 1024 + 123;
+static const size_t bufferSize = 4096;
+
+static char
+ByteAt(uint64_t pos)
+{
+   return (char)(pos * 13 + pos / 251);
+}
+
+static void
+OpenPipeEnd(int fd, const char *mode, common::Stream **out, error *err)
+{
+   common::Pointer<common::Stream> file;
+   FILE *f = fdopen(fd, mode);
+
+   if (!f)
+      ERROR_SET(err, errno, errno);
+
+   common::CreateStream(f, file.GetAddressOf(), err);
+   if (ERROR_FAILED(err))
+      fclose(f);
+   ERROR_CHECK(err);
+
+   common::CreateBufferedStream(file.Get(), bufferSize, out, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+//
+// Buffers both ends of a pipe, which cannot tell us a position or seek.
+// The writer sends odd-sized pieces, some bigger than the buffer, and
+// the reader takes them back in different odd sizes.
+//
+static bool
+PipeRun(error *err)
+{
+   int fds[2] = {-1, -1};
+   thread_id writer;
+   common::Pointer<common::Stream> in;
+   std::vector<char> buf(3 * bufferSize);
+   size_t got = 0;
+   bool ok = true;
+
+   memset(&writer, 0, sizeof(writer));
+
+   if (pipe(fds))
+      ERROR_SET(err, errno, errno);
+
+   OpenPipeEnd(fds[0], "rb", in.GetAddressOf(), err);
+   fds[0] = -1;
+   ERROR_CHECK(err);
+
+   common::create_thread(
+      [&fds] () -> void
+      {
+         common::Pointer<common::Stream> out;
+         std::vector<char> piece(2 * bufferSize);
+         size_t sent = 0;
+         size_t n = 7;
+         error err;
+
+         OpenPipeEnd(fds[1], "wb", out.GetAddressOf(), &err);
+         fds[1] = -1;
+         ERROR_CHECK(&err);
+
+         while (sent < total)
+         {
+            n = (n * 31 + 17) % piece.size() + 1;
+            n = MIN(n, total - sent);
+            for (size_t i=0; i<n; ++i)
+               piece[i] = ByteAt(sent + i);
+
+            out->Write(piece.data(), n, &err);
+            ERROR_CHECK(&err);
+            sent += n;
+         }
+
+         out->Flush(&err);
+         ERROR_CHECK(&err);
+      exit:;
+      },
+      &writer,
+      err
+   );
+   ERROR_CHECK(err);
+
+   for (size_t n = 5;;)
+   {
+      size_t r = 0;
+
+      n = (n * 29 + 11) % buf.size() + 1;
+      r = in->Read(buf.data(), n, err);
+      ERROR_CHECK(err);
+      if (!r)
+         break;
+
+      for (size_t i=0; i<r; ++i)
+      {
+         if (buf[i] != ByteAt(got + i))
+         {
+            printf("wrong byte at %zu\n", got + i);
+            ok = false;
+            goto exit;
+         }
+      }
+      got += r;
+
+      if (in->GetPosition(err) != got)
+      {
+         printf("position %llu, expected %zu\n",
+                (unsigned long long)in->GetPosition(err), got);
+         ok = false;
+         goto exit;
+      }
+   }
+
+   printf("read %zu of %zu bytes through a pipe\n", got, total);
+   ok = ok && got == total;
+
+exit:
+   if (thread_is_started(&writer))
+      join_thread(&writer);
+   if (fds[0] >= 0)
+      close(fds[0]);
+   if (fds[1] >= 0)
+      close(fds[1]);
+   return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   bool ok = false;
+
+   log_register_callback(log_callback, NULL);
+
+   ok = PipeRun(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (!ok || ERROR_FAILED(&err))
+   {
+      fprintf(stderr, "FAILED\n");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,246 @@
+#include <common/c++/coroutine.h>
+#include <common/c++/worker.h>
+#include <common/logger.h>
+#include <common/sem.h>
+#include <common/thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(COMMON_HAVE_COROUTINES)
+
+#include <atomic>
+#include <new>
+#include <stdexcept>
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+// Count heap allocations, to see whether frames come from the pool.
+//
+static std::atomic<long> allocations;
+
+void *
+operator new(size_t n)
+{
+   void *p;
+
+   ++allocations;
+   p = malloc(n ? n : 1);
+   if (!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void operator delete(void *p) noexcept           { free(p); }
+void operator delete(void *p, size_t) noexcept   { free(p); }
+
+using common::Task;
+
+static Task<int>
+Sum(int n)
+{
+   if (!n)
+      co_return 0;
+   co_return n + co_await Sum(n - 1);
+}
+
+static Task<int>
+Checked(int x, error *err)
+{
+   if (x < 0)
+      ERROR_SET(err, unknown, "negative input");
+exit:
+   co_return ERROR_FAILED(err) ? 0 : x;
+}
+
+static Task<void>
+Throws(void)
+{
+   throw 42;
+   co_return;
+}
+
+struct Results
+{
+   thread_id worker;
+   bool onWorker;
+   int sum;
+   bool errorSeen;
+   bool exceptionSeen;
+   bool emptyTaskSeen;
+   long reuseAllocations;
+   semaphore done;
+};
+
+static Task<void>
+Chain(common::WorkerThread &worker, Results &res)
+{
+   error err;
+
+   co_await common::ResumeOn(worker, &err);
+   ERROR_CHECK(&err);
+   res.onWorker = thread_is_self(&res.worker);
+
+   res.sum = co_await Sum(50);
+
+   // The error set by an inner task reaches us through err.
+   //
+   co_await Checked(1, &err);
+   ERROR_CHECK(&err);
+   co_await Checked(-1, &err);
+   res.errorSeen = ERROR_FAILED(&err);
+   error_clear(&err);
+
+   try
+   {
+      co_await Throws();
+   }
+   catch (int)
+   {
+      res.exceptionSeen = true;
+   }
+
+   // A moved-from Task has nothing to run; awaiting it is an error, not
+   // a crash.
+   //
+   {
+      Task<int> task = Sum(1);
+      Task<int> other = std::move(task);
+
+      try
+      {
+         co_await task;
+      }
+      catch (const std::logic_error&)
+      {
+         res.emptyTaskSeen = true;
+      }
+   }
+
+   // Sum(50) above left its frames in this thread's pool, so
+   // doing it again should not touch the heap.
+   //
+   {
+      long before = allocations;
+      int again = co_await Sum(50);
+      res.reuseAllocations = allocations - before;
+      if (again != res.sum)
+         res.sum = -1;
+   }
+
+exit:
+   if (ERROR_FAILED(&err))
+      ERROR_LOG(&err);
+   sm_post(&res.done);
+}
+
+// Destroyed at thread exit, after the frame pool may have been drained.
+//
+struct PendingTask
+{
+   Task<int> task;
+};
+
+static thread_local PendingTask pendingTask;
+
+static void
+FreeFrameAtExit(error *err)
+{
+   thread_id thread;
+
+   memset(&thread, 0, sizeof(thread));
+
+   common::create_thread(
+      [] () -> void
+      {
+         pendingTask.task = Sum(10);
+
+         // Cache some frames, so the pool has something to drain.
+         //
+         auto t = [] () -> Task<void> { co_await Sum(10); };
+         t().Start();
+      },
+      &thread,
+      err
+   );
+   ERROR_CHECK(err);
+
+exit:
+   join_thread(&thread);
+}
+
+static bool
+Run(error *err)
+{
+   common::WorkerThread worker;
+   Results res;
+   bool ok = false;
+
+   memset(&res, 0, sizeof(res));
+
+   sm_init(&res.done, 0, err);
+   ERROR_CHECK(err);
+
+   worker.Schedule([&res] (error *) -> void { thread_get_self(&res.worker); }, true, err);
+   ERROR_CHECK(err);
+
+   Chain(worker, res).Start();
+   sm_wait(&res.done);
+
+   printf("on worker: %d\n", res.onWorker);
+   printf("sum: %d\n", res.sum);
+   printf("error propagated: %d\n", res.errorSeen);
+   printf("exception propagated: %d\n", res.exceptionSeen);
+   printf("empty task rejected: %d\n", res.emptyTaskSeen);
+   printf("allocations on reuse: %ld\n", res.reuseAllocations);
+
+   ok = res.onWorker &&
+        res.sum == 1275 &&
+        res.errorSeen &&
+        res.exceptionSeen &&
+        res.emptyTaskSeen &&
+        !res.reuseAllocations;
+
+   FreeFrameAtExit(err);
+   ERROR_CHECK(err);
+
+exit:
+   sm_destroy(&res.done);
+   return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   bool ok = false;
+
+   log_register_callback(log_callback, NULL);
+
+   ok = Run(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (!ok || ERROR_FAILED(&err))
+   {
+      fprintf(stderr, "FAILED\n");
+      return 1;
+   }
+   return 0;
+}
+
+#else
+
+int
+main(int argc, char **argv)
+{
+   printf("Coroutines are not supported by this compiler.\n");
+   return 0;
+}
+
+#endif
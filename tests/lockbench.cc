@@ -0,0 +1,412 @@
+#include <common/c++/refcount.h>
+#include <common/cas.h>
+#include <common/logger.h>
+#include <common/mutex.h>
+#include <common/rwlock.h>
+#include <common/rwlock-biased.h>
+#include <common/spin.h>
+#include <common/thread.h>
+#include <common/time.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+//
+// Build with USE_FUTEX_MUTEX=1 to measure the futex mutex; otherwise the
+// "mutex" columns are the pthread wrapper.
+//
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+static const int opsPerRun = 2000000;
+static const int copiesPerRun = 20000000;
+
+// Plain pthread_mutex_t, the baseline.
+//
+struct PthreadLock
+{
+   pthread_mutex_t m;
+
+   PthreadLock(int flags, error *err)   { pthread_mutex_init(&m, nullptr); }
+   ~PthreadLock()                       { pthread_mutex_destroy(&m); }
+
+   void Acquire() { pthread_mutex_lock(&m); }
+   void Release() { pthread_mutex_unlock(&m); }
+
+   void GetStats(mutex_stats *stats) { memset(stats, 0, sizeof(*stats)); }
+};
+
+struct MutexLock
+{
+   mutex m;
+
+   MutexLock(int flags, error *err) { mutex_init_flags(&m, flags, err); }
+   ~MutexLock()                     { mutex_destroy(&m); }
+
+   void Acquire() { mutex_acquire(&m); }
+   void Release() { mutex_release(&m); }
+
+   void GetStats(mutex_stats *stats) { mutex_get_stats(&m, stats); }
+};
+
+//
+// nthreads threads taking the lock for a short critical section, with a
+// little work outside it.  Returns acquisitions per second.
+//
+template<typename Lock>
+static double
+LockRun(int nthreads, int flags, mutex_stats *stats, error *err)
+{
+   Lock lock(flags, err);
+   std::vector<thread_id> threads(nthreads);
+   std::atomic<int> remaining(opsPerRun);
+   volatile unsigned long counter = 0;
+   uint64_t start = 0, end = 0;
+
+   memset(stats, 0, sizeof(*stats));
+
+   for (auto &th : threads)
+      memset(&th, 0, sizeof(th));
+
+   ERROR_CHECK(err);
+
+   start = get_monotonic_time_millis();
+   for (int i=0; i<nthreads; ++i)
+   {
+      common::create_thread(
+         [&lock, &remaining, &counter] () -> void
+         {
+            while (remaining-- > 0)
+            {
+               lock.Acquire();
+               for (int j=0; j<4; ++j)
+                  counter = counter + 1;
+               lock.Release();
+
+               for (int j=0; j<8; ++j)
+                  spin_pause();
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   for (auto &th : threads)
+      join_thread(&th);
+   end = get_monotonic_time_millis();
+
+   if (!ERROR_FAILED(err) && counter != 4UL * opsPerRun)
+   {
+      fprintf(stderr, "lost updates: %lu of %lu\n", counter, 4UL * opsPerRun);
+      error_set_unknown(err, "lock did not exclude");
+   }
+
+   lock.GetStats(stats);
+   return (end > start) ? (opsPerRun * 1000.0 / (end - start)) : 0;
+}
+
+static void
+Contention(error *err)
+{
+   static const int counts[] = {2, 4, 8, 16, 32, 64};
+
+#if defined(MUTEX_FUTEX)
+   printf("mutex is futex-based.\n");
+#else
+   printf("mutex is the platform mutex.\n");
+#endif
+   printf("Lock acquisitions/sec, and contended/slept acquisitions for mutex:\n");
+   printf("%10s %12s %12s %12s %12s %12s %12s %12s\n",
+          "threads", "pthread", "mutex", "contended", "sleeps",
+          "mutex fair", "contended", "sleeps");
+
+   for (auto n : counts)
+   {
+      mutex_stats base, normal, fair;
+      double baseRate, normalRate, fairRate;
+
+      baseRate = LockRun<PthreadLock>(n, 0, &base, err);
+      ERROR_CHECK(err);
+      normalRate = LockRun<MutexLock>(n, 0, &normal, err);
+      ERROR_CHECK(err);
+      fairRate = LockRun<MutexLock>(n, MUTEX_FAIR, &fair, err);
+      ERROR_CHECK(err);
+
+      printf("%10d %12.0f %12.0f %12lu %12lu %12.0f %12lu %12lu\n",
+             n, baseRate,
+             normalRate, normal.contended, normal.sleeps,
+             fairRate, fair.contended, fair.sleeps);
+   }
+exit:;
+}
+
+struct RwLock
+{
+   rwlock m;
+
+   RwLock(error *err) { rwlock_init(&m, err); }
+   ~RwLock()          { rwlock_destroy(&m); }
+
+   void *AcquireShared()       { rwlock_acquire_shared(&m); return nullptr; }
+   void ReleaseShared(void *)  { rwlock_release_shared(&m); }
+   void Acquire()              { rwlock_acquire_exclusive(&m); }
+   void Release()              { rwlock_release_exclusive(&m); }
+};
+
+struct BiasedRwLock
+{
+   rwlock_biased m;
+
+   BiasedRwLock(error *err) { rwlock_biased_init(&m, err); }
+   ~BiasedRwLock()          { rwlock_biased_destroy(&m); }
+
+   void *AcquireShared()          { return rwlock_biased_acquire_shared(&m); }
+   void ReleaseShared(void *tok)  { rwlock_biased_release_shared(tok); }
+   void Acquire()                 { rwlock_biased_acquire_exclusive(&m); }
+   void Release()                 { rwlock_biased_release_exclusive(&m); }
+};
+
+//
+// readers threads taking the lock shared and reading what it protects.
+// If writer is set, one more thread takes it exclusive once a
+// millisecond.  Returns shared acquisitions per second.
+//
+template<typename Lock>
+static double
+ReaderRun(int readers, bool writer, error *err)
+{
+   Lock lock(err);
+   std::vector<thread_id> threads(readers + 1);
+   std::atomic<int> remaining(opsPerRun);
+   volatile unsigned long value = 0;
+   uint64_t start = 0, end = 0;
+
+   for (auto &th : threads)
+      memset(&th, 0, sizeof(th));
+
+   ERROR_CHECK(err);
+
+   start = get_monotonic_time_millis();
+
+   if (writer)
+   {
+      common::create_thread(
+         [&lock, &remaining, &value] () -> void
+         {
+            while (remaining > 0)
+            {
+               lock.Acquire();
+               value = value + 1;
+               lock.Release();
+               usleep(1000);
+            }
+         },
+         &threads[readers],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+   for (int i=0; i<readers; ++i)
+   {
+      common::create_thread(
+         [&lock, &remaining, &value] () -> void
+         {
+            while (remaining.fetch_sub(1, std::memory_order_relaxed) > 0)
+            {
+               void *token = lock.AcquireShared();
+               unsigned long v = value;
+               lock.ReleaseShared(token);
+               (void)v;
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   for (auto &th : threads)
+      join_thread(&th);
+   end = get_monotonic_time_millis();
+   return (end > start) ? (opsPerRun * 1000.0 / (end - start)) : 0;
+}
+
+static void
+Readers(error *err)
+{
+   static const int counts[] = {1, 2, 4, 8, 16, 32, 64};
+
+   printf("\nShared acquisitions/sec, without and with a writer every 1ms:\n");
+   printf("%10s %12s %12s %12s %12s\n",
+          "readers", "rwlock", "biased", "rwlock+w", "biased+w");
+
+   for (auto n : counts)
+   {
+      double plain, biased, plainW, biasedW;
+
+      plain = ReaderRun<RwLock>(n, false, err);
+      ERROR_CHECK(err);
+      biased = ReaderRun<BiasedRwLock>(n, false, err);
+      ERROR_CHECK(err);
+      plainW = ReaderRun<RwLock>(n, true, err);
+      ERROR_CHECK(err);
+      biasedW = ReaderRun<BiasedRwLock>(n, true, err);
+      ERROR_CHECK(err);
+
+      printf("%10d %12.0f %12.0f %12.0f %12.0f\n", n, plain, biased, plainW, biasedW);
+   }
+exit:;
+}
+
+// Reference counted the way refcnt_inc() and refcnt_dec() used to be,
+// with compare-and-swap loops.
+//
+struct CasObject
+{
+   volatile unsigned long ref;
+
+   CasObject() : ref(1) {}
+
+   void AddRef()
+   {
+      unsigned long old;
+      do
+      {
+         old = ref;
+      } while (!compare_and_swap(&ref, old, old + 1));
+   }
+
+   bool Release()
+   {
+      unsigned long old;
+      do
+      {
+         old = ref;
+      } while (!compare_and_swap(&ref, old, old - 1));
+      if (old == 1)
+         delete this;
+      return old == 1;
+   }
+};
+
+struct Object : public common::RefCountable
+{
+};
+
+//
+// nthreads threads copying a Pointer<T> and dropping the copy.  If
+// shared is set they all copy the same one; otherwise each has its own.
+// Returns copies per second.
+//
+template<typename T>
+static double
+PointerRun(int nthreads, bool shared, error *err)
+{
+   std::vector<common::Pointer<T>> objects(shared ? 1 : nthreads);
+   std::vector<thread_id> threads(nthreads);
+   std::atomic<int> remaining(copiesPerRun);
+   uint64_t start = 0, end = 0;
+
+   for (auto &th : threads)
+      memset(&th, 0, sizeof(th));
+
+   try
+   {
+      for (auto &p : objects)
+         p.Attach(new T());
+   }
+   catch (const std::bad_alloc&)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   start = get_monotonic_time_millis();
+   for (int i=0; i<nthreads; ++i)
+   {
+      const common::Pointer<T> &p = objects[shared ? 0 : i];
+
+      common::create_thread(
+         [&p, &remaining] () -> void
+         {
+            // Claim work in batches, so the counter is not what we measure.
+            //
+            while (remaining.fetch_sub(100, std::memory_order_relaxed) > 0)
+            {
+               for (int j=0; j<100; ++j)
+               {
+                  common::Pointer<T> copy = p;
+               }
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   for (auto &th : threads)
+      join_thread(&th);
+   end = get_monotonic_time_millis();
+   return (end > start) ? (copiesPerRun * 1000.0 / (end - start)) : 0;
+}
+
+static void
+PointerCopies(error *err)
+{
+   static const int counts[] = {1, 2, 4, 8, 16, 32, 64};
+
+   printf("\nPointer<T> copies/sec, of one shared object or one per thread:\n");
+   printf("%10s %12s %12s %12s\n", "threads", "cas shared", "shared", "private");
+
+   for (auto n : counts)
+   {
+      double cas, shared, priv;
+
+      cas = PointerRun<CasObject>(n, true, err);
+      ERROR_CHECK(err);
+      shared = PointerRun<Object>(n, true, err);
+      ERROR_CHECK(err);
+      priv = PointerRun<Object>(n, false, err);
+      ERROR_CHECK(err);
+
+      printf("%10d %12.0f %12.0f %12.0f\n", n, cas, shared, priv);
+   }
+exit:;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   int r = 0;
+
+   log_register_callback(log_callback, NULL);
+
+   Contention(&err);
+   ERROR_CHECK(&err);
+
+   Readers(&err);
+   ERROR_CHECK(&err);
+
+   PointerCopies(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   r = ERROR_FAILED(&err) ? 1 : 0;
+   return r;
+}
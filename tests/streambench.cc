@@ -0,0 +1,401 @@
+#include <common/c++/linereader.h>
+#include <common/c++/stream.h>
+#include <common/logger.h>
+#include <common/sem.h>
+#include <common/spin.h>
+#include <common/thread.h>
+#include <common/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+static const size_t fileSize = 64 * 1024 * 1024;
+static const size_t blockSize = 4096;
+static const int readsPerRun = 200000;
+
+static uint64_t
+RandomOffset(unsigned *seed)
+{
+   *seed = *seed * 1103515245 + 12345;
+   return (uint64_t)((*seed >> 8) % (fileSize / blockSize)) * blockSize;
+}
+
+static void
+CreateTestFile(const char *filename, error *err)
+{
+   common::Pointer<common::PStream> file;
+   std::vector<char> buf(1024 * 1024, 'x');
+
+   unlink(filename);
+   common::CreateStream(filename, common::ReadWriteCreate, file.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   for (size_t off=0; off<fileSize; off+=buf.size())
+   {
+      file->Write(buf.data(), buf.size(), off, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+//
+// The baseline: depth threads, each doing blocking reads one at a time.
+//
+static double
+SyncRun(const char *filename, int depth, error *err)
+{
+   common::Pointer<common::PStream> file;
+   std::vector<thread_id> threads(depth);
+   std::atomic<int> remaining(readsPerRun);
+   uint64_t start = 0, end = 0;
+
+   common::CreateStream(filename, common::ReadOnly, file.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   start = get_monotonic_time_millis();
+   for (int i=0; i<depth; ++i)
+   {
+      memset(&threads[i], 0, sizeof(threads[i]));
+      common::create_thread(
+         [&file, &remaining, i] () -> void
+         {
+            std::vector<char> buf(blockSize);
+            unsigned seed = i;
+            error err;
+
+            while (remaining-- > 0)
+            {
+               file->Read(buf.data(), blockSize, RandomOffset(&seed), &err);
+               if (ERROR_FAILED(&err))
+                  break;
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   for (auto &th : threads)
+      join_thread(&th);
+   end = get_monotonic_time_millis();
+   return (end > start) ? (readsPerRun * 1000.0 / (end - start)) : 0;
+}
+
+//
+// One thread keeping depth reads in flight; each completion starts the
+// next read.
+//
+struct AsyncRun
+{
+   common::Pointer<common::AsyncPStream> file;
+   std::vector<std::vector<char>> buffers;
+   std::atomic<int> issued;
+   std::atomic<int> completed;
+   semaphore done;
+   unsigned seed;
+
+   AsyncRun() : issued(0), completed(0), seed(0)
+   {
+      memset(&done, 0, sizeof(done));
+   }
+
+   ~AsyncRun() { sm_destroy(&done); }
+
+   void
+   Issue(int slot, error *err)
+   {
+      if (issued++ >= readsPerRun)
+         return;
+
+      file->ReadAsync(
+         buffers[slot].data(),
+         blockSize,
+         RandomOffset(&seed),
+         [this, slot] (size_t n, error *err) -> void
+         {
+            error issueErr;
+
+            if (ERROR_FAILED(err))
+               ERROR_LOG(err);
+
+            Issue(slot, &issueErr);
+            if (++completed == readsPerRun)
+               sm_post(&done);
+         },
+         err
+      );
+   }
+
+   double
+   Run(const char *filename, int depth, error *err)
+   {
+      uint64_t start = 0, end = 0;
+
+      sm_init(&done, 0, err);
+      ERROR_CHECK(err);
+
+      common::CreateStream(
+         filename,
+         common::ReadOnly | common::OpenAsync,
+         nullptr,
+         file.GetAddressOf(),
+         err
+      );
+      ERROR_CHECK(err);
+
+      buffers.resize(depth, std::vector<char>(blockSize));
+
+      start = get_monotonic_time_millis();
+      for (int i=0; i<depth; ++i)
+      {
+         Issue(i, err);
+         ERROR_CHECK(err);
+      }
+      sm_wait(&done);
+      end = get_monotonic_time_millis();
+
+   exit:
+      return (end > start) ? (readsPerRun * 1000.0 / (end - start)) : 0;
+   }
+};
+
+static void
+QueueDepth(const char *filename, error *err)
+{
+   static const int depths[] = {1, 4, 16, 64};
+
+   printf("Random %d-byte reads of a %d MiB file (reads/sec):\n",
+          (int)blockSize, (int)(fileSize / (1024 * 1024)));
+   printf("%10s %15s %15s\n", "depth", "threads+pread", "async");
+
+   for (auto depth : depths)
+   {
+      double syncRate, asyncRate;
+      AsyncRun async;
+
+      syncRate = SyncRun(filename, depth, err);
+      ERROR_CHECK(err);
+      asyncRate = async.Run(filename, depth, err);
+      ERROR_CHECK(err);
+      printf("%10d %15.0f %15.0f\n", depth, syncRate, asyncRate);
+   }
+exit:;
+}
+
+//
+// depth threads reading a MemoryStream while one more appends to it.
+//
+static double
+MemoryRun(int readers, size_t chunkSize, error *err)
+{
+   static const size_t maxSize = 16 * 1024 * 1024;
+   common::Pointer<common::PStream> stream;
+   common::MemoryStreamBuffer *buffer = nullptr;
+   common::MemoryStreamBufferOptions options;
+   std::vector<thread_id> threads(readers + 1);
+   std::atomic<int> remaining(readsPerRun);
+   uint64_t start = 0, end = 0;
+   std::vector<char> chunk(blockSize, 'x');
+
+   for (auto &th : threads)
+      memset(&th, 0, sizeof(th));
+
+   options.ChunkSize = chunkSize;
+   common::CreateMemoryStreamBuffer(0, options, buffer, err);
+   ERROR_CHECK(err);
+   common::CreateMemoryStream(buffer, common::SingleWriter, stream.GetAddressOf(), err);
+   ERROR_CHECK(err);
+   stream->Write(chunk.data(), chunk.size(), 0, err);
+   ERROR_CHECK(err);
+
+   start = get_monotonic_time_millis();
+
+   // The appender grows the buffer to maxSize, then starts over without
+   // shrinking it, so readers see resizes early in each run.
+   //
+   common::create_thread(
+      [&stream, &remaining, &chunk] () -> void
+      {
+         error err;
+
+         while (remaining > 0)
+         {
+            uint64_t size = stream->GetSize(&err);
+            if (size >= maxSize)
+            {
+               stream->Truncate(blockSize, &err);
+               size = blockSize;
+            }
+            stream->Write(chunk.data(), chunk.size(), size, &err);
+            if (ERROR_FAILED(&err))
+               break;
+         }
+      },
+      &threads[readers],
+      err
+   );
+   ERROR_CHECK(err);
+
+   for (int i=0; i<readers; ++i)
+   {
+      common::create_thread(
+         [&stream, &remaining, i] () -> void
+         {
+            std::vector<char> buf(blockSize);
+            unsigned seed = i;
+            error err;
+
+            while (remaining-- > 0)
+            {
+               uint64_t size = stream->GetSize(&err);
+               seed = seed * 1103515245 + 12345;
+               stream->Read(buf.data(), blockSize, (seed >> 8) % size, &err);
+               if (ERROR_FAILED(&err))
+                  break;
+            }
+         },
+         &threads[i],
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   for (auto &th : threads)
+      join_thread(&th);
+   end = get_monotonic_time_millis();
+   return (end > start) ? (readsPerRun * 1000.0 / (end - start)) : 0;
+}
+
+static void
+MemoryReaders(error *err)
+{
+   static const int counts[] = {1, 2, 4, 8};
+
+   printf("\nRandom %d-byte reads of a MemoryStream, with one appender (reads/sec):\n",
+          (int)blockSize);
+   printf("%10s %15s %15s\n", "readers", "contiguous", "chunked");
+
+   for (auto readers : counts)
+   {
+      double contiguous, chunked;
+
+      contiguous = MemoryRun(readers, 0, err);
+      ERROR_CHECK(err);
+      chunked = MemoryRun(readers, 1024 * 1024, err);
+      ERROR_CHECK(err);
+      printf("%10d %15.0f %15.0f\n", readers, contiguous, chunked);
+   }
+exit:;
+}
+
+//
+// LineReader over a MemoryStream holding lines of 20 to 200 bytes.
+//
+static double
+LineRun(common::PStream *lines, size_t bufferSize, error *err)
+{
+   common::Pointer<common::Stream> stream;
+   uint64_t start = 0, end = 0;
+   uint64_t size = 0;
+   size_t count = 0;
+
+   size = lines->GetSize(err);
+   ERROR_CHECK(err);
+   lines->ToStream(stream.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   {
+      common::LineReader reader(stream.Get(), bufferSize);
+
+      start = get_monotonic_time_millis();
+      while (reader.ReadLine(err))
+         ++count;
+      ERROR_CHECK(err);
+      end = get_monotonic_time_millis();
+   }
+
+exit:
+   return (end > start) ? (size * 1000.0 / (end - start) / (1024 * 1024)) : 0;
+}
+
+static void
+LineReaderThroughput(error *err)
+{
+   static const size_t bufferSizes[] = {1024, 16 * 1024, 64 * 1024, 1024 * 1024};
+   common::Pointer<common::PStream> lines;
+   std::vector<char> line;
+   uint64_t pos = 0;
+   unsigned seed = 0;
+
+   common::CreateMemoryStream(common::NoSynchronization, lines.GetAddressOf(), err);
+   ERROR_CHECK(err);
+
+   while (pos < fileSize)
+   {
+      seed = seed * 1103515245 + 12345;
+      line.assign(20 + (seed >> 8) % 180, 'x');
+      line.back() = '\n';
+      lines->Write(line.data(), line.size(), pos, err);
+      ERROR_CHECK(err);
+      pos += line.size();
+   }
+
+   printf("\nLineReader over %d MiB of text (MB/sec):\n", (int)(fileSize / (1024 * 1024)));
+   printf("%10s %15s\n", "buffer", "MB/sec");
+
+   for (auto bufferSize : bufferSizes)
+   {
+      double rate = LineRun(lines.Get(), bufferSize, err);
+      ERROR_CHECK(err);
+      printf("%10d %15.0f\n", (int)bufferSize, rate);
+   }
+exit:;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   int r = 0;
+
+   // Use tmpfs if we have it, so we measure the syscall path and not
+   // the disk.
+   //
+   const char *filename =
+      (argc > 1) ? argv[1] :
+      (access("/dev/shm", W_OK) == 0) ? "/dev/shm/streambench.dat" :
+      "streambench.dat";
+
+   log_register_callback(log_callback, NULL);
+
+   CreateTestFile(filename, &err);
+   ERROR_CHECK(&err);
+
+   QueueDepth(filename, &err);
+   ERROR_CHECK(&err);
+
+   MemoryReaders(&err);
+   ERROR_CHECK(&err);
+
+   LineReaderThroughput(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   unlink(filename);
+   r = ERROR_FAILED(&err) ? 1 : 0;
+   return r;
+}
@@ -0,0 +1,474 @@
+#include <common/c++/ring.h>
+#include <common/c++/lock.h>
+#include <common/c++/worker.h>
+#include <common/logger.h>
+#include <common/mutex.h>
+#include <common/spin.h>
+#include <common/thread.h>
+#include <common/time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WINDOWS)
+#include <sys/resource.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+static void
+log_callback(void *context, const char *buffer)
+{
+   fprintf(stderr, "%s\n", buffer);
+}
+
+//
+// The enqueue path WorkerThreadBase used to have: a single-producer ring
+// with every producer serialized on one mutex.
+//
+struct MutexRingQueue
+{
+   common::RingBuffer<int> ring;
+   mutex lock;
+
+   MutexRingQueue()  { error err; mutex_init(&lock, &err); }
+   ~MutexRingQueue() { mutex_destroy(&lock); }
+
+   int Write(int *p, int n)
+   {
+      common::locker l;
+      l.acquire(lock);
+      return ring.Write(p, n);
+   }
+
+   int Read(int *p, int n) { return ring.Read(p, n); }
+};
+
+struct MpscQueue
+{
+   common::MpscRingBuffer<int> ring;
+
+   int Write(int *p, int n) { return ring.Write(p, n); }
+   int Read(int *p, int n)  { return ring.Read(p, n); }
+};
+
+template<typename Queue>
+static double
+ContentionRun(int producers, int perProducer, error *err)
+{
+   Queue q;
+   std::vector<thread_id> threads(producers);
+   volatile bool go = false;
+   uint64_t start = 0, end = 0;
+   int total = producers * perProducer;
+   int seen = 0;
+   int buf[64];
+
+   for (auto &th : threads)
+   {
+      memset(&th, 0, sizeof(th));
+      common::create_thread(
+         [&q, &go, perProducer] () -> void
+         {
+            while (!go)
+               spin();
+            for (int i=0; i<perProducer; ++i)
+            {
+               while (!q.Write(&i, 1))
+                  spin();
+            }
+         },
+         &th,
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+   start = get_monotonic_time_millis();
+   go = true;
+   while (seen < total)
+   {
+      int r = q.Read(buf, ARRAY_SIZE(buf));
+      if (!r)
+         spin();
+      seen += r;
+   }
+   end = get_monotonic_time_millis();
+
+exit:
+   go = true;
+   for (auto &th : threads)
+      join_thread(&th);
+   return (end > start) ? (seen * 1000.0 / (end - start)) : 0;
+}
+
+static void
+Contention(error *err)
+{
+   static const int producerCounts[] = {1, 4, 16, 64};
+   const int totalOps = 2000000;
+
+   printf("MPSC enqueue contention (ops/sec):\n");
+   printf("%10s %15s %15s\n", "producers", "mutex+ring", "lock-free");
+
+   for (auto producers : producerCounts)
+   {
+      double oldRate = ContentionRun<MutexRingQueue>(producers, totalOps / producers, err);
+      ERROR_CHECK(err);
+      double newRate = ContentionRun<MpscQueue>(producers, totalOps / producers, err);
+      ERROR_CHECK(err);
+      printf("%10d %15.0f %15.0f\n", producers, oldRate, newRate);
+   }
+exit:;
+}
+
+//
+// Items go out on one ring and are echoed back on another, with at most
+// window of them in flight.  With a window of 1 this is a true ping-pong,
+// and the rate is round trips; with a full ring's worth it is pipelined
+// echo throughput.
+//
+static double
+EchoRun(int capacity, int window, int total, error *err)
+{
+   common::DynamicRingBuffer<int> ping, pong;
+   thread_id th;
+   int sent = 0, received = 0;
+   uint64_t start = 0, end = 0;
+   int buf[64];
+
+   memset(&th, 0, sizeof(th));
+
+   ping.Initialize(capacity, err);
+   ERROR_CHECK(err);
+   pong.Initialize(capacity, err);
+   ERROR_CHECK(err);
+
+   common::create_thread(
+      [&ping, &pong, total] () -> void
+      {
+         int echoed = 0;
+         int buf[64];
+
+         while (echoed < total)
+         {
+            int r = ping.Read(buf, ARRAY_SIZE(buf));
+            if (!r)
+               spin();
+            for (int i=0; i<r; )
+            {
+               int w = pong.Write(buf + i, r - i);
+               if (!w)
+                  spin();
+               i += w;
+            }
+            echoed += r;
+         }
+      },
+      &th,
+      err
+   );
+   ERROR_CHECK(err);
+
+   start = get_monotonic_time_millis();
+   while (received < total)
+   {
+      int n = MIN(total - sent, (int)ARRAY_SIZE(buf));
+      int r = 0;
+
+      n = MIN(n, window - (sent - received));
+
+      for (int i=0; i<n; ++i)
+         buf[i] = sent + i;
+      if (n > 0)
+         sent += ping.Write(buf, n);
+
+      r = pong.Read(buf, ARRAY_SIZE(buf));
+      if (!r)
+         spin();
+      received += r;
+   }
+   end = get_monotonic_time_millis();
+
+   join_thread(&th);
+
+exit:
+   return (end > start) ? (received * 1000.0 / (end - start)) : 0;
+}
+
+static void
+PingPong(error *err)
+{
+   static const int capacities[] = {16, 64, 256, 1024, 4096};
+   const int roundTrips = 200000;
+   const int total = 4000000;
+
+   printf("SPSC echo: ping-pong with one item in flight (round trips/sec),\n");
+   printf("and pipelined with the ring full (items/sec):\n");
+   printf("%10s %15s %15s\n", "capacity", "ping-pong", "pipelined");
+
+   for (auto capacity : capacities)
+   {
+      double single = EchoRun(capacity, 1, roundTrips, err);
+      ERROR_CHECK(err);
+      double pipelined = EchoRun(capacity, capacity, total, err);
+      ERROR_CHECK(err);
+      printf("%10d %15.0f %15.0f\n", capacity, single, pipelined);
+   }
+exit:;
+}
+
+static long
+ContextSwitches(void)
+{
+#if defined(_WINDOWS)
+   return 0;
+#else
+   struct rusage ru;
+   getrusage(RUSAGE_SELF, &ru);
+   return ru.ru_nvcsw + ru.ru_nivcsw;
+#endif
+}
+
+static void
+Wakeup(error *err)
+{
+   common::WorkerThread worker;
+   const int burst = 1000000;
+   const int trickle = 20000;
+   std::atomic<int> done(0);
+   uint64_t start, end;
+   long csw;
+   double latency = 0;
+
+   printf("WorkerThread wakeups:\n");
+
+   // Burst: the consumer should stay awake for most of these.
+   //
+   csw = ContextSwitches();
+   start = get_monotonic_time_millis();
+   for (int i=0; i<burst; ++i)
+   {
+      worker.Schedule([&done] (error *err) -> void { ++done; }, false, err);
+      ERROR_CHECK(err);
+   }
+   worker.Schedule([] (error *err) -> void {}, true, err);
+   ERROR_CHECK(err);
+   end = get_monotonic_time_millis();
+   csw = ContextSwitches() - csw;
+   printf("%10s %12.0f tasks/sec %8.4f csw/task\n",
+          "burst",
+          (end > start) ? (burst * 1000.0 / (end - start)) : 0.0,
+          (double)csw / burst);
+
+   // Trickle: one task at a time, so the consumer goes idle in between.
+   //
+   csw = ContextSwitches();
+   for (int i=0; i<trickle; ++i)
+   {
+      auto t0 = std::chrono::steady_clock::now();
+      std::atomic<bool> ran(false);
+
+      worker.Schedule(
+         [&latency, &ran, t0] (error *err) -> void
+         {
+            std::chrono::duration<double, std::micro> d =
+               std::chrono::steady_clock::now() - t0;
+            latency += d.count();
+            ran = true;
+         },
+         false,
+         err
+      );
+      ERROR_CHECK(err);
+      while (!ran)
+         spin();
+   }
+   csw = ContextSwitches() - csw;
+   printf("%10s %12.2f us latency %8.4f csw/task\n",
+          "trickle",
+          latency / trickle,
+          (double)csw / trickle);
+
+exit:;
+}
+
+static void
+Batch(error *err)
+{
+   common::WorkerThread worker;
+   const int total = 1000000;
+   const int batchSize = 256;
+   std::vector<common::UniqueFunction<void(error*)>> batch(batchSize);
+   std::atomic<int> done(0);
+
+   printf("WorkerThread batches of %d:\n", batchSize);
+
+   for (int pass=0; pass<2; ++pass)
+   {
+      uint64_t start = get_monotonic_time_millis(), end;
+      long csw = ContextSwitches();
+
+      for (int i=0; i<total; i+=batchSize)
+      {
+         for (auto &fn : batch)
+            fn = [&done] (error *err) -> void { ++done; };
+
+         if (pass)
+         {
+            worker.ScheduleBatch(batch.data(), batch.size(), err);
+            ERROR_CHECK(err);
+         }
+         else
+         {
+            for (auto &fn : batch)
+            {
+               worker.Schedule(std::move(fn), false, err);
+               ERROR_CHECK(err);
+            }
+         }
+      }
+      worker.Schedule([] (error *err) -> void {}, true, err);
+      ERROR_CHECK(err);
+
+      end = get_monotonic_time_millis();
+      csw = ContextSwitches() - csw;
+      printf("%10s %12.0f tasks/sec %8.4f csw/task\n",
+             pass ? "batch" : "single",
+             (end > start) ? (total * 1000.0 / (end - start)) : 0.0,
+             (double)csw / total);
+   }
+
+exit:;
+}
+
+static void
+Priority(error *err)
+{
+   const int bulk = 2000;
+   const int probes = 100;
+   static const common::SchedulePriority priorities[] =
+   {
+      common::PriorityBackground,
+      common::PriorityHigh,
+   };
+
+   printf("Latency behind %d background tasks (us):\n", bulk);
+
+   for (auto priority : priorities)
+   {
+      common::WorkerThread worker;
+      volatile unsigned sink = 0;
+      double latency = 0;
+
+      for (int i=0; i<probes; ++i)
+      {
+         std::atomic<bool> ran(false);
+
+         for (int j=0; j<bulk; ++j)
+         {
+            worker.Schedule(
+               [&sink] (error *err) -> void
+               {
+                  for (int k=0; k<1000; ++k)
+                     sink = sink + k;
+               },
+               err,
+               nullptr,
+               common::PriorityBackground
+            );
+            ERROR_CHECK(err);
+         }
+
+         auto t0 = std::chrono::steady_clock::now();
+         worker.Schedule(
+            [&latency, &ran, t0] (error *err) -> void
+            {
+               std::chrono::duration<double, std::micro> d =
+                  std::chrono::steady_clock::now() - t0;
+               latency += d.count();
+               ran = true;
+            },
+            err,
+            nullptr,
+            priority
+         );
+         ERROR_CHECK(err);
+
+         while (!ran)
+            spin();
+      }
+
+      printf("%10s %12.1f\n",
+             priority == common::PriorityHigh ? "high" : "background",
+             latency / probes);
+
+      // Let the bulk work finish before the next run.
+      //
+      worker.Schedule([] (error *err) -> void {}, true, err, nullptr, common::PriorityBackground);
+      ERROR_CHECK(err);
+   }
+
+exit:;
+}
+
+static void
+RoundTrip(error *err)
+{
+   common::WorkerThread worker;
+   const int calls = 200000;
+   int counter = 0;
+   uint64_t start, end;
+   long csw;
+
+   csw = ContextSwitches();
+   start = get_monotonic_time_millis();
+   for (int i=0; i<calls; ++i)
+   {
+      worker.Schedule([&counter] (error *err) -> void { ++counter; }, true, err);
+      ERROR_CHECK(err);
+   }
+   end = get_monotonic_time_millis();
+   csw = ContextSwitches() - csw;
+
+   printf("Synchronous Schedule round trip:\n");
+   printf("%10s %12.2f us/call %8.4f csw/call\n",
+          "sync",
+          (end > start) ? ((end - start) * 1000.0 / calls) : 0.0,
+          (double)csw / calls);
+
+exit:;
+}
+
+int
+main(int argc, char **argv)
+{
+   error err;
+   int r = 0;
+
+   log_register_callback(log_callback, NULL);
+
+   Contention(&err);
+   ERROR_CHECK(&err);
+
+   PingPong(&err);
+   ERROR_CHECK(&err);
+
+   Wakeup(&err);
+   ERROR_CHECK(&err);
+
+   Batch(&err);
+   ERROR_CHECK(&err);
+
+   Priority(&err);
+   ERROR_CHECK(&err);
+
+   RoundTrip(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   r = ERROR_FAILED(&err) ? 1 : 0;
+   return r;
+}